@@ -53,19 +53,26 @@
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
  *        ranges - these will never be matched.
+ *
+ *   tlb_setasid: load ENTRYHI into the processor's entryhi register,
+ *        making its PID field the current address space ID. All the
+ *        functions above clobber entryhi, so call this afterwards if
+ *        using ASIDs.
  */
 
 void tlb_random(uint32_t entryhi, uint32_t entrylo);
 void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
+void tlb_setasid(uint32_t entryhi);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
+ * Note that the MIPS has support for a 6-bit address space ID. dumbvm
+ * does not use it; the real VM system puts an ASID in TLBHI_PID so that
+ * entries of different address spaces can coexist in the TLB (see
+ * arch/mips/vm/vmtlb.c). TLBLO_GLOBAL is always left zero, as are the
  * bits that aren't assigned a meaning.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
@@ -78,7 +85,11 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
+
+/* Number of distinct address space IDs */
+#define NUM_ASID      64
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
@@ -67,6 +67,9 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/* The reverse, for kernel addresses within kseg0. */
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
@@ -113,17 +116,28 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
- * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * A shootdown carries a batch of translations to invalidate. A cpu
+ * asked to invalidate more than TLBSHOOTDOWN_FLUSH translations in
+ * one go just flushes its whole TLB instead. We'll take up to 16
+ * shootdowns queued per cpu.
  */
 
+struct addrspace;
+
+/* One translation to invalidate */
+struct tlbinval {
+	struct addrspace *ti_as;	/* address space it belongs to */
+	vaddr_t ti_vaddr;		/* page */
+};
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	const struct tlbinval *ts_inval;	/* translations to invalidate */
+	unsigned ts_ninval;			/* how many */
+	unsigned *ts_pending;			/* cpus still to do it */
 };
 
 #define TLBSHOOTDOWN_MAX 16
+#define TLBSHOOTDOWN_FLUSH 16
 
 
 #endif /* _MIPS_VM_H_ */
@@ -156,6 +156,8 @@ mips_trap(struct trapframe *tf)
 
 		old_in = curthread->t_in_interrupt;
 		curthread->t_in_interrupt = 1;
+		/* so hardclock knows whom to charge the tick to */
+		curcpu->c_intr_user = !iskern;
 
 		/*
 		 * The processor has turned interrupts off; if the
@@ -38,6 +38,8 @@
 #include <addrspace.h>
 #include <synch.h>
 #include <proc.h>
+#include <copyinout.h>
+#include "opt-dumbvm.h"
 
 /*
  * System call dispatcher.
@@ -187,11 +189,36 @@ syscall(struct trapframe *tf)
 
 		case SYS_waitpid:
 		err = sys_waitpid((__pid_t) tf->tf_a0,
-			(int *) tf->tf_a1,
+			(userptr_t) tf->tf_a1,
 			(int) tf->tf_a2,
 			&retval);
 		break;
 
+		case SYS_wait4:
+		err = sys_wait4((__pid_t) tf->tf_a0,
+			(userptr_t) tf->tf_a1,
+			(int) tf->tf_a2,
+			(userptr_t) tf->tf_a3,
+			&retval);
+		break;
+
+		case SYS_getrusage:
+		err = sys_getrusage((int) tf->tf_a0,
+			(userptr_t) tf->tf_a1);
+		break;
+
+		case SYS_getpriority:
+		err = sys_getpriority((int) tf->tf_a0,
+			(int) tf->tf_a1,
+			&retval);
+		break;
+
+		case SYS_setpriority:
+		err = sys_setpriority((int) tf->tf_a0,
+			(int) tf->tf_a1,
+			(int) tf->tf_a2);
+		break;
+
 		case SYS___getcwd:
       	err = sys___getcwd((char *)tf->tf_a0, (size_t)tf->tf_a1, &retval);
     	break;
@@ -200,6 +227,64 @@ syscall(struct trapframe *tf)
 		err = sys_chdir((char *)tf->tf_a0, &retval);
 		break;
 
+#if !OPT_DUMBVM
+		case SYS_sbrk:
+		err = sys_sbrk((intptr_t) tf->tf_a0, &retval);
+		break;
+
+		case SYS_mmap:
+		{
+			int fd;
+			off_t offset;
+
+			/* fd is at sp+16, the 64-bit offset aligned at sp+24 */
+			err = copyin((const_userptr_t) tf->tf_sp + 16, &fd,
+				sizeof(fd));
+			if (err) {
+				break;
+			}
+			err = copyin((const_userptr_t) tf->tf_sp + 24, &offset,
+				sizeof(offset));
+			if (err) {
+				break;
+			}
+			err = sys_mmap((userptr_t) tf->tf_a0,
+				(size_t) tf->tf_a1,
+				(int) tf->tf_a2,
+				(int) tf->tf_a3,
+				fd, offset,
+				&retval);
+		}
+		break;
+
+		case SYS_munmap:
+		err = sys_munmap((userptr_t) tf->tf_a0,
+			(size_t) tf->tf_a1);
+		break;
+
+		case SYS_madvise:
+		err = sys_madvise((userptr_t) tf->tf_a0,
+			(size_t) tf->tf_a1,
+			(int) tf->tf_a2);
+		break;
+
+		case SYS_mincore:
+		err = sys_mincore((userptr_t) tf->tf_a0,
+			(size_t) tf->tf_a1,
+			(userptr_t) tf->tf_a2);
+		break;
+
+		case SYS_mlock:
+		err = sys_mlock((userptr_t) tf->tf_a0,
+			(size_t) tf->tf_a1);
+		break;
+
+		case SYS_munlock:
+		err = sys_munlock((userptr_t) tf->tf_a0,
+			(size_t) tf->tf_a1);
+		break;
+#endif
+
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
@@ -260,7 +345,10 @@ enter_forked_process(void *data1, unsigned long data2)
 	/* activate address space */
 	as_activate();
 
-    /* enter user mode */
+	/* copy the trapframe onto our own stack and free the heap copy */
 	tf = *parent_copy_tf;
+	kfree(parent_copy_tf);
+
+    /* enter user mode */
 	mips_usermode(&tf);
 }
\ No newline at end of file
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * MIPS TLB management for the VM system.
+ *
+ * The machine-independent fault handler (vm/vm.c) decides what
+ * translation to install; this file knows how to talk to the TLB.
+ * Not used with dumbvm, which does its own thing.
+ *
+ * Most user TLB misses never get here: the fast path in
+ * exception-mips1.S (mips_utlb_refill) walks the current address
+ * space's page table itself and writes the entry into a random slot.
+ * For that it needs, for each cpu, the page directory of the address
+ * space that is current there, in cpupagetables[] (indexed by cpu
+ * number like cpustacks[]; 0 when there is none), and it counts its
+ * refills in cpufastrefills[]. Both live here because nothing else
+ * looks at them. Only the misses it cannot handle come to vm_fault
+ * and through vm_tlb_load.
+ *
+ * Those refills use round-robin replacement: each cpu keeps the index of
+ * the next slot to write in c_tlb_next. Right after a flush this just
+ * fills the empty slots in order; once the TLB is full it evicts the
+ * oldest refill, which is a reasonable approximation of FIFO without
+ * having to look at every entry on every miss.
+ *
+ * Entries are tagged with an address space ID (TLBHI_PID), so
+ * switching address spaces does not require a flush. ASIDs are
+ * handed out per cpu: each cpu has a generation number and a counter,
+ * and an address space remembers, for each cpu, the ASID it got there
+ * and in which generation. If the generation is stale, the address
+ * space gets the next free ASID. When a cpu runs out of ASIDs it
+ * flushes its TLB and starts a new generation, which implicitly
+ * revokes every ASID it handed out before. ASID 0 is never handed
+ * out.
+ *
+ * An address space that moves to a different cpu always gets a fresh
+ * ASID there, because any entries left over from the last time it
+ * ran on that cpu may have been made stale by changes done elsewhere.
+ *
+ * When a page is paged out its translation must disappear from every
+ * cpu, not just this one: vm_tlb_shootdown sends a shootdown IPI to
+ * each other cpu that may hold it and waits until they have all done
+ * it. A cpu can only hold entries for an address space that has a
+ * current-generation ASID there, so cpus the address space never ran
+ * on (or that have flushed since) are left alone. Each shootdown
+ * carries a whole batch of translations, possibly from several
+ * address spaces, so paging out a batch costs one IPI per cpu rather
+ * than one per page. Shootdowns are done one at a time, so no cpu
+ * ever has more than one queued.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <vm.h>
+
+#define ASID_TO_TLBHI(asid) ((uint32_t)(asid) << TLBHI_PIDSHIFT)
+
+/* For mips_utlb_refill; set and read with interrupts off. */
+vaddr_t cpupagetables[MAXCPUS];
+unsigned cpufastrefills[MAXCPUS];
+
+static struct spinlock shootdown_spinlock = SPINLOCK_INITIALIZER;
+static struct wchan *shootdown_wchan;	/* waiting for other cpus */
+static struct lock *shootdown_lock;	/* one shootdown at a time */
+
+void
+vm_tlb_bootstrap(void)
+{
+	/* mips_utlb_refill hardwires these. */
+	KASSERT(PTE_TLBVALID == TLBLO_VALID);
+	KASSERT(PTE_TLBDIRTY == TLBLO_DIRTY);
+	KASSERT(PTE_PRELOADED == 0x8);
+	KASSERT(PT_L1_SHIFT == 22 && PT_L1_SIZE == 1024);
+	KASSERT(PT_L2_SHIFT == 12 && PT_L2_SIZE == 1024);
+	KASSERT(sizeof(pte_t) == 4);
+
+	shootdown_wchan = wchan_create("tlbshootdown");
+	shootdown_lock = lock_create("tlbshootdown");
+	if (shootdown_wchan == NULL || shootdown_lock == NULL) {
+		panic("vm_tlb_bootstrap: out of memory\n");
+	}
+}
+
+/*
+ * Invalidate every entry in this CPU's TLB. Must be at splhigh.
+ */
+static
+void
+tlb_flush_all(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	curcpu->c_tlb_next = 0;
+	tlb_setasid(ASID_TO_TLBHI(curcpu->c_asid));
+}
+
+/*
+ * Invalidate every entry in this CPU's TLB.
+ */
+void
+vm_tlb_flush(void)
+{
+	int spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	tlb_flush_all();
+	splx(spl);
+}
+
+/*
+ * Make AS the address space seen by this cpu's TLB, giving it an
+ * ASID here if it does not have a valid one, and by the fast refill
+ * path.
+ */
+void
+vm_tlb_activate(struct addrspace *as)
+{
+	struct cpu *c;
+	unsigned n;
+	int spl;
+
+	spl = splhigh();
+
+	c = curcpu;
+	n = c->c_number;
+	KASSERT(n < MAXCPUS);
+
+	if (as->as_lastcpu != n) {
+		/* Migrated: forget whatever ASID we had here. */
+		as->as_asidgen[n] = 0;
+		as->as_lastcpu = n;
+	}
+
+	if (as->as_asidgen[n] != c->c_asid_gen) {
+		if (c->c_asid_next == NUM_ASID) {
+			/* Out of ASIDs: start a new generation. */
+			c->c_asid_gen++;
+			c->c_asid_next = 1;
+			c->c_asid_rollovers++;
+			tlb_flush_all();
+		}
+		as->as_asid[n] = c->c_asid_next++;
+		as->as_asidgen[n] = c->c_asid_gen;
+	}
+
+	c->c_asid = as->as_asid[n];
+	tlb_setasid(ASID_TO_TLBHI(c->c_asid));
+	cpupagetables[n] = (vaddr_t)as->as_pt->pt_dir;
+
+	splx(spl);
+}
+
+/*
+ * Take this cpu's current address space away from the fast refill
+ * path, so that it can be destroyed. Its ASID and TLB entries stay.
+ */
+void
+vm_tlb_deactivate(void)
+{
+	int spl;
+
+	spl = splhigh();
+	cpupagetables[curcpu->c_number] = 0;
+	splx(spl);
+}
+
+/*
+ * Number of user TLB misses the fast path has handled on cpu CPUNUM.
+ */
+unsigned
+vm_tlb_fastrefills(unsigned cpunum)
+{
+	KASSERT(cpunum < MAXCPUS);
+	return cpufastrefills[cpunum];
+}
+
+/*
+ * Remove every entry belonging to AS from this cpu's TLB. Used when
+ * the address space goes away, or when its pages become shared and
+ * must lose write permission, without throwing away the entries of
+ * other address spaces.
+ */
+void
+vm_tlb_flush_as(struct addrspace *as)
+{
+	uint32_t ehi, elo, pid;
+	unsigned n;
+	int i, spl;
+
+	spl = splhigh();
+
+	n = curcpu->c_number;
+	if (as->as_asidgen[n] != curcpu->c_asid_gen) {
+		/* No valid ASID here, so no entries either. */
+		splx(spl);
+		return;
+	}
+
+	pid = ASID_TO_TLBHI(as->as_asid[n]);
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_read(&ehi, &elo, i);
+		if ((elo & TLBLO_VALID) && (ehi & TLBHI_PID) == pid) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	tlb_setasid(ASID_TO_TLBHI(curcpu->c_asid));
+
+	splx(spl);
+}
+
+/*
+ * Install a translation for VADDR -> PADDR in this CPU's TLB, in the
+ * current address space. If there is already an entry for VADDR
+ * (e.g. a read-only one that is being upgraded) it is replaced in
+ * place, since the MIPS must never hold two matching entries; unless
+ * PRELOAD, in which case it is left alone. Preloads (fault-around)
+ * do not count as TLB misses.
+ */
+static
+void
+tlb_install(vaddr_t vaddr, paddr_t paddr, bool writeable, bool preload)
+{
+	uint32_t ehi, elo, oldehi, oldelo;
+	int i, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spl = splhigh();
+
+	ehi = vaddr | ASID_TO_TLBHI(curcpu->c_asid);
+	elo = paddr | TLBLO_VALID;
+	if (writeable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		if (!preload) {
+			tlb_write(ehi, elo, i);
+		}
+		splx(spl);
+		return;
+	}
+
+	/* Not there: refill into the next round-robin slot. */
+	i = curcpu->c_tlb_next;
+	curcpu->c_tlb_next = (i + 1) % NUM_TLB;
+	if (preload) {
+		curcpu->c_faultaround_pages++;
+	}
+	else {
+		curcpu->c_tlb_misses++;
+	}
+
+	tlb_read(&oldehi, &oldelo, i);
+	if (oldelo & TLBLO_VALID) {
+		curcpu->c_tlb_evictions++;
+	}
+
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", vaddr, paddr);
+	tlb_write(ehi, elo, i);
+
+	splx(spl);
+}
+
+int
+vm_tlb_load(vaddr_t vaddr, paddr_t paddr, bool writeable)
+{
+	tlb_install(vaddr, paddr, writeable, false);
+	return 0;
+}
+
+void
+vm_tlb_preload(vaddr_t vaddr, paddr_t paddr, bool writeable)
+{
+	tlb_install(vaddr, paddr, writeable, true);
+}
+
+/*
+ * Drop the translation for VADDR in the current address space from
+ * this CPU's TLB, if present.
+ */
+void
+vm_tlb_invalidate(vaddr_t vaddr)
+{
+	uint32_t ehi;
+	int i, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	spl = splhigh();
+
+	ehi = vaddr | ASID_TO_TLBHI(curcpu->c_asid);
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setasid(ASID_TO_TLBHI(curcpu->c_asid));
+
+	splx(spl);
+}
+
+/*
+ * Drop the translation for VADDR in address space AS from this cpu's
+ * TLB, if AS has an ASID here. Must be at splhigh.
+ */
+static
+void
+tlb_invalidate_as(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t ehi;
+	unsigned n;
+	int i;
+
+	n = curcpu->c_number;
+	if (as->as_asidgen[n] != curcpu->c_asid_gen) {
+		return;
+	}
+
+	ehi = vaddr | ASID_TO_TLBHI(as->as_asid[n]);
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setasid(ASID_TO_TLBHI(curcpu->c_asid));
+}
+
+/*
+ * Whether cpu C may have TLB entries for any of the N translations in
+ * INVAL. This looks at C's ASID generation without C's cooperation;
+ * that is safe because it only ever goes up, and when it does C has
+ * flushed its TLB.
+ */
+static
+bool
+tlb_cpu_may_hold(struct cpu *c, const struct tlbinval *inval, unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		if (inval[i].ti_as->as_asidgen[c->c_number] == c->c_asid_gen) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Drop the N translations in INVAL from every cpu's TLB, and wait
+ * until that is done.
+ */
+void
+vm_tlb_shootdown(const struct tlbinval *inval, unsigned n)
+{
+	struct tlbshootdown ts;
+	struct cpu *c;
+	unsigned i, pending;
+	int spl;
+
+	for (i = 0; i < n; i++) {
+		KASSERT((inval[i].ti_vaddr & PAGE_FRAME) == inval[i].ti_vaddr);
+	}
+
+	ts.ts_inval = inval;
+	ts.ts_ninval = n;
+	ts.ts_pending = &pending;
+
+	lock_acquire(shootdown_lock);
+
+	/*
+	 * Stay on this cpu while deciding which ones are "other". Count
+	 * each target before sending to it, since it may finish before
+	 * we are done sending to the rest.
+	 */
+	spl = splhigh();
+	pending = 0;
+	for (i = 0; i < cpu_count(); i++) {
+		c = cpu_get(i);
+		if (c == curcpu->c_self || !tlb_cpu_may_hold(c, inval, n)) {
+			continue;
+		}
+		spinlock_acquire(&shootdown_spinlock);
+		pending++;
+		spinlock_release(&shootdown_spinlock);
+		ipi_tlbshootdown(c, &ts);
+		curcpu->c_shootdowns_sent++;
+	}
+	for (i = 0; i < n; i++) {
+		tlb_invalidate_as(inval[i].ti_as, inval[i].ti_vaddr);
+	}
+	splx(spl);
+
+	spinlock_acquire(&shootdown_spinlock);
+	while (pending > 0) {
+		wchan_sleep(shootdown_wchan, &shootdown_spinlock);
+	}
+	spinlock_release(&shootdown_spinlock);
+
+	lock_release(shootdown_lock);
+}
+
+/*
+ * Handle a shootdown IPI from vm_tlb_shootdown.
+ */
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+	curcpu->c_shootdowns_recv++;
+	curcpu->c_shootdown_pages += ts->ts_ninval;
+	if (ts->ts_ninval > TLBSHOOTDOWN_FLUSH) {
+		/* Cheaper than probing for each one. */
+		curcpu->c_shootdown_flushes++;
+		tlb_flush_all();
+	}
+	else {
+		for (i = 0; i < ts->ts_ninval; i++) {
+			tlb_invalidate_as(ts->ts_inval[i].ti_as,
+					  ts->ts_inval[i].ti_vaddr);
+		}
+	}
+	splx(spl);
+
+	spinlock_acquire(&shootdown_spinlock);
+	KASSERT(*ts->ts_pending > 0);
+	(*ts->ts_pending)--;
+	wchan_wakeall(shootdown_wchan, &shootdown_spinlock);
+	spinlock_release(&shootdown_spinlock);
+}
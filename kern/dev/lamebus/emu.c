@@ -56,6 +56,7 @@
 #include "autoconf.h"
 #include <current.h>
 #include <proc.h>
+#include <kmem_cache.h>
 
 /* Register offsets */
 #define REG_HANDLE    0
@@ -93,6 +94,9 @@
 #define EMU_RES_UNKNOWN      12
 #define EMU_RES_UNSUPP       13
 
+/* Where vnodes come from; shared by all emu devices */
+static struct kmem_cache *emufs_vnode_cache;
+
 ////////////////////////////////////////////////////////////
 //
 // Hardware ops
@@ -531,7 +535,7 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
-	kfree(ev);
+	kmem_cache_free(emufs_vnode_cache, ev);
 	return 0;
 }
 
@@ -860,8 +864,9 @@ static
 int
 emufs_mmap(struct vnode *v)
 {
+	/* Files can be mapped; the VM system uses VOP_READ/VOP_WRITE. */
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 //////////////////////////////
@@ -1181,9 +1186,10 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	/* Didn't have one; create it */
 
-	ev = kmalloc(sizeof(struct emufs_vnode));
+	ev = kmem_cache_alloc(emufs_vnode_cache);
 	if (ev==NULL) {
 		lock_release(ef->ef_emu->e_lock);
+		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -1195,7 +1201,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
-		kfree(ev);
+		kmem_cache_free(emufs_vnode_cache, ev);
 		return result;
 	}
 
@@ -1205,7 +1211,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		vnode_cleanup(&ev->ev_v);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
-		kfree(ev);
+		kmem_cache_free(emufs_vnode_cache, ev);
 		return result;
 	}
 
@@ -1349,6 +1355,13 @@ config_emu(struct emu_softc *sc, int emuno)
 {
 	char name[32];
 
+	/* one cache for the vnodes of all emu devices */
+	if (emufs_vnode_cache == NULL) {
+		emufs_vnode_cache = kmem_cache_create("emufs_vnode",
+						      sizeof(struct emufs_vnode),
+						      NULL, NULL);
+	}
+
 	sc->e_lock = lock_create("emufs-lock");
 	if (sc->e_lock == NULL) {
 		return ENOMEM;
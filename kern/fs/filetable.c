@@ -35,8 +35,37 @@
 #include <fs.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
+#include <kmem_cache.h>
 
 struct fs_filetable sys_filetable;
+
+/*
+* File structures come from an object cache; a free one keeps its lock
+*/
+static struct kmem_cache *fs_file_cache;
+
+static
+int
+fs_file_ctor(void *obj)
+{
+    struct fs_file *file = obj;
+
+    file->f_lock = lock_create("fs_file");
+    if (file->f_lock == NULL) {
+        return ENOMEM;
+    }
+    return 0;
+}
+
+static
+void
+fs_file_dtor(void *obj)
+{
+    struct fs_file *file = obj;
+
+    lock_destroy(file->f_lock);
+}
 /*
 * Initialize file table head node to NULL
 */
@@ -46,6 +75,9 @@ filetable_init(void)
     int err_in, err_out, err_err;
     char con_filename[5];
 
+    fs_file_cache = kmem_cache_create("fs_file", sizeof(struct fs_file),
+                                      fs_file_ctor, fs_file_dtor);
+
     /* initialize system filetable lock */
     sys_filetable.lock = lock_create("sys_filetable_lock");
     if (sys_filetable.lock == NULL) {
@@ -53,9 +85,9 @@ filetable_init(void)
     }
 
     /* create 3 file structs for standard files */
-    sys_filetable.stdin = (struct fs_file *) kmalloc(sizeof(struct fs_file));
-    sys_filetable.stdout = (struct fs_file *) kmalloc(sizeof(struct fs_file));
-    sys_filetable.stderr = (struct fs_file *) kmalloc(sizeof(struct fs_file));
+    sys_filetable.stdin = filetable_allocfile();
+    sys_filetable.stdout = filetable_allocfile();
+    sys_filetable.stderr = filetable_allocfile();
 
     /* if unable to allocate files */
     if (sys_filetable.stdin == NULL || sys_filetable.stdout == NULL
@@ -87,21 +119,16 @@ filetable_init(void)
         return err_err;
     }
 
-    /* create a lock for each file */
-    sys_filetable.stdin->f_lock = lock_create("stdin");
-    sys_filetable.stdout->f_lock = lock_create("stdout");
-    sys_filetable.stderr->f_lock = lock_create("stderr");
-    if (sys_filetable.stdin->f_lock == NULL
-     || sys_filetable.stdout->f_lock == NULL
-     || sys_filetable.stderr->f_lock == NULL) {
-        return ENOMEM;
-     }
-
     /* initialize refcount */
      sys_filetable.stdin->f_refcount = 1;
      sys_filetable.stdout->f_refcount = 1;
      sys_filetable.stderr->f_refcount = 1;
 
+    /* and open mode */
+    sys_filetable.stdin->f_mode = O_RDONLY;
+    sys_filetable.stdout->f_mode = O_WRONLY;
+    sys_filetable.stderr->f_mode = O_WRONLY;
+
     /* set head and tail to stdin, then add two new files (stdout, stderr) */
     sys_filetable.head = sys_filetable.stdin;
     sys_filetable.tail = sys_filetable.head;
@@ -126,10 +153,28 @@ filetable_cleanup(void)
     /* remove every node */
     while (ptr->f_prev != NULL) {
         ptr = ptr->f_prev;
-        kfree(ptr->f_next);
+        filetable_freefile(ptr->f_next);
     }
 }
 
+/*
+* Allocate a file structure, with its f_lock created and free
+*/
+struct fs_file *
+filetable_allocfile(void)
+{
+    return kmem_cache_alloc(fs_file_cache);
+}
+
+/*
+* Free a file structure that is not in the file table; f_lock must be free
+*/
+void
+filetable_freefile(struct fs_file *file)
+{
+    kmem_cache_free(fs_file_cache, file);
+}
+
 /*
 * Add new file entry in the file table (which is a DLL).
 * The new file gets appended and the pointer is moved so that it always points
@@ -149,7 +194,8 @@ filetable_addfile(struct fs_file *newfile)
 
 /*
 * Removes a node from the system file table, node is usually obtained by the
-* process from its local file table
+* process from its local file table. Called with rmfile->f_lock held, which
+* is released before the file structure is freed
 */
 void
 filetable_removefile(struct fs_file *rmfile)
@@ -184,8 +230,8 @@ filetable_removefile(struct fs_file *rmfile)
     sys_filetable.size--;
 
     /* finally, deallocate the fs_file structure from kernel space */
-    lock_destroy(rmfile->f_lock);
-    kfree((void *) rmfile);
+    lock_release(rmfile->f_lock);
+    filetable_freefile(rmfile);
     lock_release(sys_filetable.lock);
 }
 
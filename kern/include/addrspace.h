@@ -36,9 +36,81 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
+struct pagecache;
+
+#if !OPT_DUMBVM
+/*
+ * The user stack starts out one page long and grows down on demand,
+ * up to VM_STACKMAXPAGES pages (this must be > 64K so argument blocks
+ * of size ARG_MAX will fit). At least VM_STACKGUARDPAGES unmapped
+ * pages are kept between the stack and the region below it (usually
+ * the heap), so running off the end of either faults.
+ */
+#define VM_STACKMAXPAGES   256
+#define VM_STACKGUARDPAGES 4
+
+/*
+ * An address space may lock at most 1/VM_MLOCKFRACTION of the pages
+ * the coremap manages in memory with mlock.
+ */
+#define VM_MLOCKFRACTION   4
+
+/* Region permissions */
+#define REGION_READ      0x1
+#define REGION_WRITE     0x2
+#define REGION_EXEC      0x4
+
+/*
+ * Region - a contiguous, page-aligned range of virtual addresses with
+ * the same permissions and the same backing.
+ *
+ * A region may be backed by a file (rg_vnode != NULL): the bytes from
+ * rg_vaddr to rg_vaddr+rg_filesize come from rg_vnode at offset
+ * rg_offset, and everything else in the region reads as zero. This is
+ * how ELF segments are loaded lazily. Regions without a vnode are
+ * anonymous and zero-filled on first touch.
+ *
+ * Regions created by mmap (rg_mmap) may instead get their pages from
+ * a page cache (rg_cache, see pagecache.h), page rg_offset/PAGE_SIZE
+ * of the cache being the first page of the region. If rg_shared is
+ * set, writes go to the cached pages; otherwise the cached pages are
+ * copied on write like pages shared with a fork relative. Read-only
+ * ELF segments are mapped from the executable's page cache the same
+ * way, so that every process running a program shares its text.
+ * The cache keeps a list of the regions mapping it, linked through
+ * rg_cachenext, so that it can find the page table entries of a page
+ * it wants to page out; rg_as is the address space of the region.
+ *
+ * rg_advice is the access pattern last declared for the region with
+ * madvise (MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL); vm_fault
+ * reads ahead in sequential regions.
+ */
+struct region {
+	vaddr_t rg_vbase;		/* first page of the region */
+	size_t rg_npages;		/* number of pages */
+	unsigned rg_perm;		/* REGION_READ/WRITE/EXEC */
+
+	struct vnode *rg_vnode;		/* backing file or NULL */
+	off_t rg_offset;		/* file offset of rg_vaddr */
+	vaddr_t rg_vaddr;		/* (unaligned) start of file data */
+	size_t rg_filesize;		/* bytes of file data */
+
+	bool rg_mmap;			/* created by mmap */
+	struct pagecache *rg_cache;	/* page cache, or NULL */
+	struct region *rg_cachenext;	/* next region mapping rg_cache */
+	struct addrspace *rg_as;	/* address space it is in */
+	bool rg_shared;			/* MAP_SHARED */
+	unsigned rg_advice;		/* MADV_* access pattern */
+
+	struct region *rg_next;		/* next region in the list */
+};
+#endif
 
 
 /*
@@ -58,7 +130,24 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct region *as_regions;	/* list of regions */
+        struct pagetable *as_pt;	/* page table */
+        struct region *as_stack;	/* stack region (in as_regions) */
+        struct region *as_heap;		/* heap region (in as_regions) */
+        vaddr_t as_heapbreak;		/* current break; heap ends at
+        				   the page boundary above it */
+
+        /* TLB address space IDs, per cpu; see arch/mips/vm/vmtlb.c */
+        unsigned as_asid[MAXCPUS];	/* ASID on each cpu */
+        unsigned as_asidgen[MAXCPUS];	/* generation of as_asid */
+        unsigned as_lastcpu;		/* cpu last activated on */
+
+        /* Resident pages (including pages shared with others) */
+        unsigned as_rss;
+        struct spinlock as_rsslock;	/* pageout changes it too */
+
+        /* Pages locked with mlock (PTE_LOCKED) */
+        unsigned as_nlocked;
 #endif
 };
 
@@ -99,6 +188,77 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_backing - record that the region containing VADDR is
+ *                filled from a file instead of being zero-filled.
+ *                Called by load_elf instead of copying the segment,
+ *                so the pages are read in by vm_fault on first touch.
+ *                Not available with dumbvm.
+ *
+ *    as_find_region - return the region containing VADDR, or NULL.
+ *                Not available with dumbvm.
+ *
+ *    as_grow_stack - extend the stack down to cover VADDR, if VADDR
+ *                is within reach of the stack and not in the guard
+ *                gap. Returns the stack region, or NULL. Not available
+ *                with dumbvm.
+ *
+ *    as_mmap   - add an mmap region of NPAGES pages with permissions
+ *                PERM (REGION_*) at *VADDR, or if *VADDR is 0 at an
+ *                address of our choosing below the stack, handed back
+ *                in *VADDR. If PC is not NULL the pages come from it,
+ *                starting at byte OFFSET (page aligned), and the region
+ *                takes over the caller's reference to it; SHARED says
+ *                whether writes go to the cache. Fails with EINVAL if
+ *                the range given is unusable, ENOMEM if no room.
+ *                Not available with dumbvm.
+ *
+ *    as_munmap - remove the mmap mappings in NPAGES pages from VADDR,
+ *                splitting regions as needed. Fails with EINVAL if the
+ *                range covers anything not created by mmap. Not
+ *                available with dumbvm.
+ *
+ *    as_sbrk   - move the break by AMOUNT bytes (which may be
+ *                negative), handing back the old break. The heap
+ *                region starts out empty right above the executable
+ *                (see as_complete_load) and its pages are only
+ *                allocated on first touch; pages given back by
+ *                shrinking are freed at once. Fails with EINVAL if the
+ *                break would go below the start of the heap and ENOMEM
+ *                if the heap would run into another region. Not
+ *                available with dumbvm.
+ *
+ *    as_madvise - apply ADVICE (MADV_*) to the NPAGES pages from
+ *                VADDR. MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL
+ *                are recorded in every region the range touches;
+ *                MADV_WILLNEED faults the pages in now (as far as
+ *                memory allows); MADV_DONTNEED frees them, so they
+ *                are filled in afresh on next touch. Fails with
+ *                ENOMEM if part of the range is not mapped, EINVAL
+ *                if ADVICE is unknown or a page to free is locked.
+ *                Not available with dumbvm.
+ *
+ *    as_mincore - set VEC[i] to 1 if page i of the NPAGES pages from
+ *                VADDR is resident, 0 if not. Fails with ENOMEM if
+ *                part of the range is not mapped. Not available with
+ *                dumbvm.
+ *
+ *    as_mlock  - fault in the NPAGES pages from VADDR and lock them
+ *                in memory, breaking copy-on-write sharing of
+ *                writable private pages first. Locking a page twice
+ *                is the same as once; locks are not inherited by
+ *                as_copy. Fails with ENOMEM if part of the range is
+ *                not mapped or accessible, EAGAIN if it would take
+ *                the address space past its share of memory (see
+ *                VM_MLOCKFRACTION). Not available with dumbvm.
+ *
+ *    as_munlock - unlock the NPAGES pages from VADDR so they can be
+ *                paged out again. Fails with ENOMEM if part of the
+ *                range is not mapped. Not available with dumbvm.
+ *
+ *    as_rss_adjust - add DELTA to the count of resident pages, as
+ *                pages are mapped in, paged out or freed. Not
+ *                available with dumbvm.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -118,15 +278,44 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+int               as_define_backing(struct addrspace *as, struct vnode *v,
+                                    off_t offset, vaddr_t vaddr,
+                                    size_t filesize);
+struct region    *as_find_region(struct addrspace *as, vaddr_t vaddr);
+struct region    *as_grow_stack(struct addrspace *as, vaddr_t vaddr);
+int               as_mmap(struct addrspace *as, vaddr_t *vaddr,
+                          size_t npages, unsigned perm,
+                          struct pagecache *pc, off_t offset,
+                          bool shared);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr,
+                            size_t npages);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_madvise(struct addrspace *as, vaddr_t vaddr,
+                             size_t npages, int advice);
+int               as_mincore(struct addrspace *as, vaddr_t vaddr,
+                             size_t npages, unsigned char *vec);
+int               as_mlock(struct addrspace *as, vaddr_t vaddr,
+                           size_t npages);
+int               as_munlock(struct addrspace *as, vaddr_t vaddr,
+                             size_t npages);
+void              as_rss_adjust(struct addrspace *as, int delta);
+#endif
+
 
 /*
  * Functions in loadelf.c
  *    load_elf - load an ELF user program executable into the current
  *               address space. Returns the entry point (initial PC)
  *               in the space pointed to by ENTRYPOINT.
+ *
+ *    load_elf_forget - forget any headers load_elf has cached for
+ *               executable V. Called when V is reclaimed.
  */
 
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
+void load_elf_forget(struct vnode *v);
 
 
 #endif /* _ADDRSPACE_H_ */
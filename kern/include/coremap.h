@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Coremap - physical page (frame) allocator.
+ *
+ * There is one entry per physical page of RAM. Pages that hold the
+ * kernel image, the coremap itself and anything stolen before the VM
+ * system started are marked fixed and are never handed out. Every
+ * other page is either free, owned by the kernel (kmalloc and friends)
+ * or owned by a user address space.
+ *
+ * Free pages are managed by a binary buddy system: free memory is
+ * kept as blocks of 2^k pages (k up to COREMAP_MAXORDER in
+ * coremap.c), each aligned to its own size, with one doubly-linked
+ * list per order threaded through the coremap entries. The first
+ * page of a free block records the block's size in cme_npages.
+ * Allocating splits the smallest block that is big enough; freeing
+ * merges a block with its buddy (the block it was split from) while
+ * the buddy is free too. Multi-page kernel allocations, which need
+ * physically contiguous pages, thus cost O(log n) instead of a scan
+ * of the whole coremap, and freed memory coalesces back into large
+ * blocks instead of fragmenting. A multi-page allocation uses the
+ * front of a block rounded up to a power of two and gives the rest
+ * back right away.
+ *
+ * Free pages that are known to be all zeros are kept on a separate
+ * list, as single pages outside the buddy system. Idle cpus move
+ * pages from the buddy lists to it (up to
+ * a fixed fraction of memory) so that zero-filling a user page on
+ * first touch usually costs nothing; when the pool runs dry the page
+ * is zeroed synchronously instead. Other allocations only take
+ * zeroed pages when nothing else is free; a multi-page allocation
+ * that finds no big enough block returns the whole pool to the buddy
+ * lists and tries again.
+ *
+ * User pages are reference counted so that fork can share them
+ * copy-on-write between parent and child: a user page is only
+ * returned to the free list when its last reference is dropped.
+ *
+ * User pages can be paged out (see swap.c). For that each user page
+ * records the address space and virtual address it is mapped at
+ * (its owner; pages shared by fork have none and are never paged
+ * out), whether it was referenced since the clock hand last passed,
+ * whether it has been modified since it was last written to swap,
+ * and the swap slot holding its clean copy, if any. Pages in a page
+ * cache have no owner either; instead they record the cache and their
+ * index in it, and are paged out through the cache (pagecache_evict).
+ *
+ * A user page can be pinned ("busy") by whoever is working on it:
+ * the fault handler while it maps it, the address space code while
+ * it copies or frees it, or the pageout code while it writes it out.
+ * Anyone else who wants it waits until it is unpinned. Newly
+ * allocated user pages come back pinned.
+ */
+
+#include <vm.h>
+
+struct addrspace;
+struct pagecache;
+
+/* Page states */
+#define CME_FREE      0		/* free (buddy block or zero list) */
+#define CME_FIXED     1		/* kernel image, coremap, early boot */
+#define CME_KERNEL    2		/* kernel allocation (alloc_kpages) */
+#define CME_USER      3		/* user page (vm_alloc_upage) */
+#define CME_ZEROING   4		/* being zeroed by an idle cpu */
+
+struct coremap_entry {
+	unsigned cme_state;	/* CME_* */
+	unsigned cme_npages;	/* length of the allocation or free block
+				   starting here; 0 in the middle */
+	unsigned cme_refcount;	/* address spaces mapping a user page */
+	unsigned cme_prev;	/* free list links (page numbers) */
+	unsigned cme_next;
+	bool cme_zeroed;	/* free and known to be all zeros */
+
+	/* user pages only */
+	struct addrspace *cme_as;	/* owner, or NULL if shared */
+	vaddr_t cme_vaddr;		/* where the owner maps it */
+	unsigned cme_swapslot;		/* clean copy in swap, or SWAP_NOSLOT */
+	bool cme_busy;			/* pinned */
+	bool cme_referenced;		/* used since the clock last passed */
+	bool cme_dirty;			/* differs from swap copy (if any) */
+	struct pagecache *cme_cache;	/* page cache holding it, or NULL */
+	unsigned cme_cacheidx;		/* its index in cme_cache */
+};
+
+/* Pre-zeroed page pool statistics */
+struct coremap_zerostats {
+	unsigned zs_pool;	/* zeroed pages on hand */
+	unsigned zs_target;	/* how many idle cpus try to keep */
+	unsigned zs_hits;	/* zeroed allocations served from the pool */
+	unsigned zs_misses;	/* zeroed allocations zeroed synchronously */
+	unsigned zs_idlezeroed;	/* pages zeroed by idle cpus */
+};
+
+/*
+ * Functions in coremap.c:
+ *
+ *    coremap_bootstrap - take over all remaining physical memory from
+ *                        ram.c. Before this is called, allocations are
+ *                        served by ram_stealmem and are never freed.
+ *
+ *    coremap_alloc     - allocate NPAGES physically contiguous pages
+ *                        in state STATE (CME_KERNEL or CME_USER).
+ *                        Returns the physical address of the first
+ *                        page, or 0 if there is not enough memory.
+ *
+ *    coremap_alloc_zeroed - allocate one zero-filled user page, from
+ *                        the pre-zeroed pool if possible. Returns 0 if
+ *                        no memory is available.
+ *
+ *    coremap_zero_one  - zero one free page for the pool, if the pool
+ *                        is below its target. Returns false if there
+ *                        was nothing to do. Called by idle cpus.
+ *
+ *    coremap_zerostats - get the pool statistics.
+ *
+ *    coremap_printstats - print the buddy allocator statistics: free
+ *                        blocks per order, the largest free block,
+ *                        how fragmented free memory is, splits and
+ *                        merges, and failed multi-page allocations.
+ *
+ *    coremap_free      - free the allocation starting at PADDR. For a
+ *                        user page this only drops one reference.
+ *
+ *    coremap_incref    - add a reference to the user page at PADDR.
+ *
+ *    coremap_decref    - drop a reference to the pinned user page at
+ *                        PADDR that is not the last one, leaving it
+ *                        pinned.
+ *
+ *    coremap_refcount  - number of references to the user page at
+ *                        PADDR. Only a snapshot unless the caller
+ *                        otherwise knows nobody else can change it.
+ *
+ *    coremap_freepages - number of free pages.
+ *
+ *    coremap_totalpages - number of pages managed (i.e. not fixed).
+ *
+ *    coremap_pin       - pin the user page at PADDR. If it is already
+ *                        pinned, sleeps until it is not and returns
+ *                        false without pinning: by then the page may
+ *                        have been paged out and reused, so the caller
+ *                        must look up its mapping again. Also returns
+ *                        false if PADDR is no longer a user page.
+ *
+ *    coremap_unpin     - unpin the user page at PADDR. Freeing a
+ *                        user page also unpins it; pages must be
+ *                        pinned to be freed.
+ *
+ *    coremap_setowner  - record that AS maps the pinned user page at
+ *                        PADDR at VADDR; AS==NULL makes it unevictable
+ *                        (unless it is in a page cache).
+ *                        Also marks it referenced.
+ *
+ *    coremap_setcache  - record that the pinned user page at PADDR is
+ *                        page IDX of page cache PC, or with PC==NULL
+ *                        that it no longer is. Also marks it
+ *                        referenced.
+ *
+ *    coremap_setclean  - note that the pinned user page at PADDR has
+ *                        an up-to-date copy in swap slot SLOT.
+ *
+ *    coremap_setdirty  - note that the pinned user page at PADDR is
+ *                        about to be modified. Returns the swap slot
+ *                        of its now stale copy (or SWAP_NOSLOT) for
+ *                        the caller to free.
+ *
+ *    coremap_isdirty   - whether the pinned user page at PADDR is
+ *                        dirty.
+ *
+ *    coremap_getslot   - swap slot of the pinned user page at PADDR,
+ *                        or SWAP_NOSLOT. coremap_setslot changes it;
+ *                        when a user page is freed its slot is freed
+ *                        with it.
+ *
+ *    coremap_pickvictim - advance the clock hand to the next user page
+ *                        that can be paged out and was not referenced
+ *                        since the hand last passed, clearing the
+ *                        referenced bit of those that were. Returns it
+ *                        pinned, with its owner in AS and VADDR and,
+ *                        for a page cache page (which has no owner),
+ *                        the cache in PC and its index in IDX (PC is
+ *                        NULL otherwise). Returns 0 if there is no
+ *                        candidate.
+ *
+ *    coremap_setwatermark - wake the pageout thread whenever the
+ *                        number of free pages drops below LOWWATER.
+ *
+ *    coremap_pageout_wait - sleep until free memory is below the low
+ *                        watermark. If STALLED, sleep at least until
+ *                        the next allocation even if it already is.
+ */
+
+void     coremap_bootstrap(void);
+paddr_t  coremap_alloc(unsigned npages, unsigned state);
+paddr_t  coremap_alloc_zeroed(void);
+bool     coremap_zero_one(void);
+void     coremap_zerostats(struct coremap_zerostats *zs);
+void     coremap_printstats(void);
+void     coremap_free(paddr_t paddr);
+void     coremap_incref(paddr_t paddr);
+void     coremap_decref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+unsigned coremap_freepages(void);
+unsigned coremap_totalpages(void);
+bool     coremap_pin(paddr_t paddr);
+void     coremap_unpin(paddr_t paddr);
+void     coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void     coremap_setcache(paddr_t paddr, struct pagecache *pc, unsigned idx);
+void     coremap_setclean(paddr_t paddr, unsigned slot);
+unsigned coremap_setdirty(paddr_t paddr);
+bool     coremap_isdirty(paddr_t paddr);
+unsigned coremap_getslot(paddr_t paddr);
+void     coremap_setslot(paddr_t paddr, unsigned slot);
+paddr_t  coremap_pickvictim(struct addrspace **as, vaddr_t *vaddr,
+                            struct pagecache **pc, unsigned *idx);
+void     coremap_setwatermark(unsigned lowwater);
+void     coremap_pageout_wait(bool stalled);
+
+
+#endif /* _COREMAP_H_ */
@@ -35,6 +35,11 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+/*
+ * Number of scheduler priority levels, and so of run queues per cpu.
+ * Level 0 is the highest priority. See schedule() in thread.c.
+ */
+#define SCHED_NLEVELS	8
 
 /*
  * Per-cpu structure
@@ -61,13 +66,34 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	bool c_intr_user;		/* Interrupt came from user mode */
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 * TLB refill state and statistics kept by the VM system.
+	 */
+	unsigned c_tlb_next;		/* Next TLB slot to refill */
+	unsigned c_tlb_misses;		/* TLB misses refilled */
+	unsigned c_tlb_evictions;	/* Valid TLB entries replaced */
+	unsigned c_asid;		/* ASID currently loaded */
+	unsigned c_asid_next;		/* Next ASID to hand out */
+	unsigned c_asid_gen;		/* Current ASID generation */
+	unsigned c_asid_rollovers;	/* Times ASIDs ran out (TLB flushed) */
+	unsigned c_shootdowns_sent;	/* Shootdown IPIs sent to others */
+	unsigned c_shootdowns_recv;	/* Shootdown IPIs handled */
+	unsigned c_shootdown_pages;	/* Translations invalidated by them */
+	unsigned c_shootdown_flushes;	/* ...by flushing the whole TLB */
+	unsigned c_faultarounds;	/* Faults that preloaded neighbours */
+	unsigned c_faultaround_pages;	/* TLB entries preloaded */
+	unsigned c_faultaround_mapped;	/* ...of page cache pages mapped */
+	unsigned c_faultaround_refaults; /* TLB misses on preloaded pages */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* One per level */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -112,6 +138,14 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Access to the list of all cpus, e.g. for summing statistics.
+ *
+ * cpu_count returns the number of cpus; cpu_get returns cpu number N.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned n);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -71,6 +71,9 @@ struct device_ops {
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
 
 
+/* Set up device vnode allocation; called from vfs_bootstrap. */
+void devvnode_bootstrap(void);
+
 /* Create vnode for a vfs-level device. */
 struct vnode *dev_create_vnode(struct device *dev);
 
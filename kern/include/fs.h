@@ -127,6 +127,8 @@ extern struct fs_filetable sys_filetable;
 /* Functions to use the filetable */
 int filetable_init(void);
 void filetable_cleanup(void);
+struct fs_file *filetable_allocfile(void);
+void filetable_freefile(struct fs_file *file);
 void filetable_addfile(struct fs_file *newfile);
 void filetable_removefile(struct fs_file *rmfile_node);
 size_t filetable_size(void);
@@ -67,6 +67,11 @@ struct rusage {
 	__counter_t ru_nsignals;	/* signals delivered (count) */
 	__counter_t ru_nvcsw;		/* voluntary context switches (count)*/
 	__counter_t ru_nivcsw;		/* involuntary ditto (count) */
+
+	/* OS/161 extensions */
+	__size_t ru_rss;		/* current RSS (kb) */
+	__counter_t ru_tlbrefill;	/* slow-path TLB refills (count) */
+	__counter_t ru_cowcopies;	/* pages copied on write (count) */
 };
 
 /* limit codes for getrusage/setrusage */
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KHEAPPROF_H_
+#define _KHEAPPROF_H_
+
+/*
+ * Kernel heap profiler.
+ *
+ * While it is on, every kmalloc is counted, in per-cpu counters, under
+ * its call site and its size class, and the block is remembered so
+ * that its kfree can be charged back to the same site and class. What
+ * is allocated minus what is freed is then what each site has
+ * outstanding, which is where leaks and heap growth show up.
+ *
+ * The profile can be read from the device "kheap:" (e.g. with cat or
+ * /sbin/khprof) or printed with the khprof menu command. Writing "on"
+ * to the device starts a fresh profile, "off" stops it and keeps the
+ * counts for reading, and "reset" clears the counts while it runs.
+ *
+ * Only blocks the profiler has room to remember are counted under
+ * their site and class; the rest are counted as untracked, so that
+ * what shows as outstanding really is.
+ *
+ * kheapprof_bootstrap allocates the profiler's tables and attaches
+ * the device. Profiling is off until turned on, since while it is on
+ * every kmalloc and kfree takes a lock shared between cpus. Call it
+ * once all cpus are running.
+ *
+ * kmalloc and kfree call kheapprof_alloc and kheapprof_free only when
+ * kheapprof_enabled is set, so the profiler costs one test when off.
+ */
+
+extern volatile bool kheapprof_enabled;
+
+void kheapprof_bootstrap(void);
+void kheapprof_alloc(void *ptr, size_t size, vaddr_t site);
+void kheapprof_free(void *ptr);
+int kheapprof_command(const char *cmd);
+void kheapprof_print(void);
+
+
+#endif /* _KHEAPPROF_H_ */
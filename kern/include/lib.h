@@ -125,7 +125,11 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ *
+ * kmalloc_bootstrap must be called before the first kmalloc, right
+ * after ram_bootstrap.
  */
+void kmalloc_bootstrap(void);
 void *kmalloc(size_t size);
 void kfree(void *ptr);
 void kheap_printstats(void);
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for memory-mapped objects (including the read-only
+ * segments of running executables, see as_define_backing).
+ *
+ * A page cache holds the pages of one mmapped object, indexed by page
+ * number within the object. For a file there is at most one cache per
+ * vnode (hung off vn_pagecache), shared by every mapping of the file
+ * in every process, so all MAP_SHARED mappings see the same pages and
+ * MAP_PRIVATE mappings start out from them and copy on write. A cache
+ * without a vnode holds shared anonymous memory; it is only reachable
+ * from the regions mapping it (which after fork may be in several
+ * processes).
+ *
+ * File pages are read in with VOP_READ on first touch (past the end
+ * of the file they read as zeros). Pages dirtied through MAP_SHARED
+ * mappings are written back with VOP_WRITE when the last mapping of
+ * the file goes away, at which point the cache is freed. Writes never
+ * extend the file.
+ *
+ * Writes to the file through the file system are not seen by the
+ * cache right away. Instead the cache remembers the generation number
+ * of the vnode (see vnode_modified) its clean pages were read at, and
+ * whenever a new mapping attaches to it after the file changed, reads
+ * them all again in place; the next exec of a rewritten program thus
+ * runs the new text. Dirty pages are left alone: they are written back
+ * over whatever the file system wrote.
+ *
+ * Each cache page holds one coremap reference of its own plus one
+ * per page table entry mapping it. Cached pages have no owner in the
+ * coremap; the coremap instead records the cache and index of each
+ * (see coremap_setcache), and the pageout code hands clean ones to
+ * pagecache_evict, which finds the page table entries mapping them
+ * through the list of regions mapping the cache (pc_mappers), unmaps
+ * them and frees the page. Dirty pages stay in memory until the cache
+ * goes away.
+ */
+
+#include <vm.h>
+
+struct vnode;
+struct lock;
+struct region;
+
+struct pagecache {
+	struct vnode *pc_vnode;		/* file, or NULL if anonymous */
+	unsigned pc_refcount;		/* regions using this cache */
+	struct lock *pc_lock;		/* protects the rest */
+	paddr_t *pc_pages;		/* frame | PCP_DIRTY, or 0 */
+	unsigned pc_npages;		/* size of pc_pages */
+	unsigned pc_gen;		/* vnode generation of clean pages */
+	struct region *pc_mappers;	/* regions mapping it */
+};
+
+/* Flag in pc_pages entries */
+#define PCP_DIRTY     0x1	/* modified through a shared mapping */
+
+/*
+ * Functions in pagecache.c:
+ *
+ *    pagecache_bootstrap - initialize.
+ *
+ *    pagecache_attach   - get the page cache of V, creating it if
+ *                         needed, or a new anonymous one if V is NULL.
+ *                         Returns it with a reference for the caller.
+ *                         Rereads clean pages if V changed since they
+ *                         were read.
+ *
+ *    pagecache_incref   - add a reference.
+ *
+ *    pagecache_release  - drop a reference. The last one writes back
+ *                         dirty pages and frees the cache.
+ *
+ *    pagecache_getpage  - return the page at index IDX, reading it in
+ *                         if needed (setting *READIN if it had to read
+ *                         the file). It comes back pinned and with an
+ *                         extra coremap reference for the caller's page
+ *                         table entry.
+ *
+ *    pagecache_peekpage - like pagecache_getpage, but only if page IDX
+ *                         is already in the cache: returns false
+ *                         instead of reading it in.
+ *
+ *    pagecache_setdirty - mark page IDX (which must be present) dirty.
+ *
+ *    pagecache_isdirty  - whether page IDX is dirty.
+ *
+ *    pagecache_addmapper - add RG, which maps PC and is in its address
+ *                         space's region list, to the mappers of PC.
+ *
+ *    pagecache_delmapper - take RG off the mappers of PC, before its
+ *                         pages are freed.
+ *
+ *    pagecache_evict    - page out page IDX of PC, at PADDR, which the
+ *                         caller has pinned: unmap it everywhere and
+ *                         free it. Returns false, with the page just
+ *                         unpinned, if it is dirty, locked in memory,
+ *                         was used since the pageout code last looked
+ *                         at it, or cannot be got at right now.
+ */
+
+void pagecache_bootstrap(void);
+int  pagecache_attach(struct vnode *v, struct pagecache **ret);
+void pagecache_incref(struct pagecache *pc);
+void pagecache_release(struct pagecache *pc);
+int  pagecache_getpage(struct pagecache *pc, unsigned idx, paddr_t *ret,
+                       bool *readin);
+bool pagecache_peekpage(struct pagecache *pc, unsigned idx, paddr_t *ret);
+void pagecache_setdirty(struct pagecache *pc, unsigned idx);
+bool pagecache_isdirty(struct pagecache *pc, unsigned idx);
+void pagecache_addmapper(struct pagecache *pc, struct region *rg);
+void pagecache_delmapper(struct pagecache *pc, struct region *rg);
+bool pagecache_evict(struct pagecache *pc, unsigned idx, paddr_t paddr);
+
+
+#endif /* _PAGECACHE_H_ */
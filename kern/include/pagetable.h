@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Per-address-space page table.
+ *
+ * Two-level table indexed by virtual page number: the top 10 bits of
+ * a user address select an entry in the directory, the next 10 bits
+ * select a page table entry in a second-level table. Second-level
+ * tables are exactly one page long and are only allocated when some
+ * page in the 4M range they cover is touched, so a sparse address
+ * space (text at the bottom, stack at the top) costs very little.
+ *
+ * A page table entry holds the physical frame in the high 20 bits
+ * (same layout as TLBLO_PPAGE) and flag bits in the low 12 bits.
+ * When the page has been paged out, PTE_VALID is clear, PTE_SWAPPED
+ * is set and the high 20 bits hold the swap slot instead.
+ *
+ * PTE_LOCKED marks a page locked in memory with mlock. It is only
+ * ever set on a valid entry, and the page it maps is kept without an
+ * owner in the coremap so the pageout code leaves it alone.
+ * PTE_PRELOADED marks a valid entry that fault-around loaded into the
+ * TLB without a fault on it, for the statistics; see vm_faultaround.
+ *
+ * User TLB misses are first handled by a fast path in assembly
+ * (mips_utlb_refill in exception-mips1.S) that walks this table and,
+ * if PTE_TLBVALID is set and PTE_PRELOADED is not, loads the entry
+ * into the TLB as is; only otherwise is vm_fault called. PTE_TLBVALID
+ * and PTE_TLBDIRTY sit where the MIPS puts TLBLO_VALID and
+ * TLBLO_DIRTY, so the entry only needs its other flag bits masked
+ * off. vm_fault sets them when it loads a translation, to what it
+ * loaded. Whoever makes that translation wrong while the page stays
+ * resident clears them first, while nobody else can change the entry
+ * (page pinned, or for the clock coremap locked and page not pinned),
+ * and then takes care of the TLB:
+ *
+ *    - the pageout code, before shooting the page down;
+ *    - the clock, when it takes away a page's referenced mark, so
+ *      that the next miss goes to vm_fault and marks it again;
+ *    - as_copy (PTE_TLBDIRTY only), when fork shares the page.
+ */
+
+#include <vm.h>
+
+typedef uint32_t pte_t;
+
+/* Fields in a page table entry */
+#define PTE_FRAME     0xfffff000	/* physical frame of the page */
+#define PTE_VALID     0x00000001	/* page is resident in PTE_FRAME */
+#define PTE_SWAPPED   0x00000002	/* page is in swap slot PTE_SLOT */
+#define PTE_LOCKED    0x00000004	/* mlocked: kept resident */
+#define PTE_PRELOADED 0x00000008	/* TLB loaded by fault-around */
+#define PTE_TLBVALID  0x00000200	/* refill may load it as is */
+#define PTE_TLBDIRTY  0x00000400	/* ...and writable */
+
+#define PTE_SLOTSHIFT 12
+#define PTE_SLOT(pte) ((pte) >> PTE_SLOTSHIFT)
+#define PTE_MKSWAPPED(slot) (((pte_t)(slot) << PTE_SLOTSHIFT) | PTE_SWAPPED)
+
+#define PT_L1_SHIFT   22
+#define PT_L2_SHIFT   12
+#define PT_L1_SIZE    1024
+#define PT_L2_SIZE    1024
+
+#define PT_L1_INDEX(va) (((va) >> PT_L1_SHIFT) & (PT_L1_SIZE - 1))
+#define PT_L2_INDEX(va) (((va) >> PT_L2_SHIFT) & (PT_L2_SIZE - 1))
+
+struct pagetable {
+	pte_t *pt_dir[PT_L1_SIZE];
+};
+
+/*
+ * Functions in pagetable.c:
+ *
+ *    pt_create  - allocate an empty page table. Returns NULL on
+ *                 out-of-memory.
+ *
+ *    pt_destroy - free the page table itself. Frames referenced by
+ *                 the entries are not touched; the address space code
+ *                 releases those first.
+ *
+ *    pt_lookup  - return a pointer to the entry for VADDR. If CREATE
+ *                 is set the second-level table is allocated on
+ *                 demand; otherwise NULL is returned when there is no
+ *                 second-level table covering VADDR. NULL is also
+ *                 returned if allocation fails.
+ *
+ *    pt_pin     - pin (see coremap.h) the frame a valid entry maps and
+ *                 return it, making sure the entry still maps it once
+ *                 pinned. Returns 0 if the entry is not valid (any
+ *                 more). May sleep.
+ */
+
+struct pagetable *pt_create(void);
+void              pt_destroy(struct pagetable *pt);
+pte_t            *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+paddr_t           pt_pin(pte_t *pte);
+
+
+#endif /* _PAGETABLE_H_ */
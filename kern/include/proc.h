@@ -46,6 +46,21 @@ struct addrspace;
 struct thread;
 struct vnode;
 
+/*
+ * Resource usage counters, reported by getrusage and wait4. Times are
+ * in hardclocks; memory is in pages. They are only updated by the
+ * process itself (from vm_fault, or from hardclock while it runs).
+ */
+struct proc_usage {
+	unsigned pu_utime;		/* hardclocks taken in user mode */
+	unsigned pu_stime;		/* hardclocks taken in the kernel */
+	unsigned pu_minflt;		/* faults served without I/O */
+	unsigned pu_majflt;		/* faults that read a page in */
+	unsigned pu_tlbrefill;		/* TLB entries loaded by vm_fault */
+	unsigned pu_cowcopies;		/* pages copied on write or on fork */
+	unsigned pu_maxrss;		/* most pages resident at once */
+};
+
 /*
  * Process structure.
  *
@@ -98,10 +113,22 @@ struct proc {
 	/* Lock for an active process */
 	struct lock *p_lock_active;
 	struct lock *p_lock_wait;
+
+	/* Resource usage of this process, and of its children waited for */
+	struct proc_usage p_usage;
+	struct proc_usage p_cusage;
+
+	/* Scheduling priority (nice value), PRIO_MIN to PRIO_MAX */
+	int p_nice;
 };
 
-/* Process list head */
+/*
+ * Process list head. proc_listlock protects the list and every
+ * process's p_parent; a process found on the list while holding it
+ * stays valid until it is released.
+ */
 extern struct proc *proc_head;
+extern struct spinlock proc_listlock;
 
 /* Process ID list element structure */
 struct pid_list_elem{
@@ -133,6 +160,9 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/* Add the usage counters in FROM to those in TO. */
+void proc_usage_add(struct proc_usage *to, const struct proc_usage *from);
+
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
 
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap: paging user pages out to a disk device.
+ *
+ * The swap device (SWAP_DEVICE, attached with vfs_swapon at boot) is
+ * divided into page-sized slots, tracked with a bitmap. A page that
+ * has been paged out is recorded in its owner's page table as a swap
+ * slot instead of a frame (see pagetable.h) and is read back in by
+ * vm_fault on the next touch. A page read back in keeps its slot
+ * until it is modified, so paging it out again costs no I/O.
+ *
+ * Victims are chosen by a clock over the coremap. A pageout thread
+ * wakes up whenever free memory drops below a low watermark and
+ * pages out until it is above a high watermark again, so faulting
+ * processes normally find a free page without waiting for a disk
+ * write; if they do not, they page out one themselves.
+ *
+ * If there is no swap device, nothing is ever paged out and running
+ * out of memory fails with ENOMEM as before.
+ */
+
+/* Device to swap to */
+#define SWAP_DEVICE "lhd0:"
+
+/* "null" slot number */
+#define SWAP_NOSLOT ((unsigned)-1)
+
+/*
+ * Functions in swap.c:
+ *
+ *    swap_bootstrap  - attach the swap device, if there is one, and
+ *                      start the pageout thread.
+ *
+ *    swap_alloc      - allocate a swap slot. Returns ENOSPC if swap
+ *                      is full or there is no swap.
+ *
+ *    swap_free       - release swap slot SLOT.
+ *
+ *    swap_read       - read swap slot SLOT into the page at PADDR.
+ *
+ *    swap_write      - write the page at PADDR to swap slot SLOT.
+ *
+ *    swap_evict      - page out up to MAX user pages, chosen by the
+ *                      clock, with a single TLB shootdown. Clean
+ *                      page cache pages are just dropped, even with
+ *                      no swap. Returns 0 if at least one page was
+ *                      freed, or an error (ENOMEM if there was
+ *                      nothing to evict).
+ *
+ *    swap_printstats - print swap usage and counters.
+ */
+
+void swap_bootstrap(void);
+int  swap_alloc(unsigned *slot);
+void swap_free(unsigned slot);
+int  swap_read(unsigned slot, paddr_t paddr);
+int  swap_write(unsigned slot, paddr_t paddr);
+int  swap_evict(unsigned max);
+void swap_printstats(void);
+
+
+#endif /* _SWAP_H_ */
@@ -72,9 +72,17 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks come from an object cache whose constructor creates the wait
+ * channel and spinlock, so lock_create only has to copy the name,
+ * which goes in lk_namebuf unless it is too long. lock_bootstrap
+ * creates the cache and must be called before the first lock_create.
  */
+#define LOCK_NAMELEN 32
+
 struct lock {
         char *lk_name;
+        char lk_namebuf[LOCK_NAMELEN];  /* lk_name, if it fits */
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
         // add what you need here
         // (don't forget to mark things volatile as needed)
@@ -84,6 +92,7 @@ struct lock {
         volatile bool lk_value;
 };
 
+void lock_bootstrap(void);
 struct lock *lock_create(const char *name);
 void lock_destroy(struct lock *);
 void lock_init(struct lock *lock, struct thread *newthread);
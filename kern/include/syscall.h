@@ -33,6 +33,7 @@
 
 #include <cdefs.h> /* for __DEAD */
 struct trapframe; /* from <machine/trapframe.h> */
+struct proc_usage; /* from <proc.h> */
 
 /*
  * The system call dispatcher.
@@ -51,6 +52,13 @@ void enter_forked_process(void *data1, unsigned long data2);
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
 
+/* Set up the pool of argument buffers for execv. */
+int execv_arena_init(void);
+
+/* Wait for and reap a child process; the kernel side of waitpid/wait4. */
+int proc_wait(__pid_t pid, int options, int *status,
+	      struct proc_usage *usage, int *retval);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -69,8 +77,21 @@ int sys_getppid(int *retpid);
 int sys_fork(struct trapframe *tf, int *retval);
 int sys_execv(userptr_t progname, userptr_t args);
 int sys__exit(int status);
-int sys_waitpid(__pid_t pid, int *status, int options, int *retval);
+int sys_waitpid(__pid_t pid, userptr_t status, int options, int *retval);
+int sys_wait4(__pid_t pid, userptr_t status, int options, userptr_t usage,
+              int *retval);
+int sys_getrusage(int who, userptr_t usage);
+int sys_getpriority(int which, int who, int *retval);
+int sys_setpriority(int which, int who, int prio);
 int sys___getcwd(char * buf, size_t size, int *retval);
 int sys_chdir(char * pathname, int *retval);
+int sys_sbrk(intptr_t amount, int *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+             off_t offset, int *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_madvise(userptr_t addr, size_t len, int advice);
+int sys_mincore(userptr_t addr, size_t len, userptr_t vec);
+int sys_mlock(userptr_t addr, size_t len);
+int sys_munlock(userptr_t addr, size_t len);
 
 #endif /* _SYSCALL_H_ */
\ No newline at end of file
@@ -85,6 +85,18 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields.
+	 *
+	 * t_level is the run queue the thread goes on (0 is the highest
+	 * priority) and t_ticks the number of hardclocks it has used of
+	 * its time slice at that level. They are changed only by the
+	 * thread's own cpu while it runs, or with the run queue lock
+	 * held (or by whoever wakes it up) while it does not.
+	 */
+	unsigned t_level;		/* Current priority level */
+	unsigned t_ticks;		/* Ticks used of the current slice */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -158,11 +170,23 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge a clock tick to the current thread. Returns true if it should
+ * yield the cpu. Called from the timer interrupt.
+ */
+bool thread_charge_tick(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
+/*
+ * Move the current thread to the top priority level its process is
+ * allowed, e.g. after the process's priority has been changed.
+ */
+void thread_reprioritize(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
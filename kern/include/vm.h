@@ -58,5 +58,81 @@ void free_kpages(vaddr_t addr);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Physical pages for user address spaces (not available with dumbvm).
+ * vm_alloc_upage returns 0 if no memory is available;
+ * vm_alloc_zeroed_upage likewise, and the page is zero-filled.
+ */
+paddr_t vm_alloc_upage(void);
+paddr_t vm_alloc_zeroed_upage(void);
+void vm_free_upage(paddr_t paddr);
+
+/*
+ * Background work for an idle cpu, called from the idle loop with
+ * no spinlocks held. Returns false if there is nothing to do (not
+ * available with dumbvm).
+ */
+bool vm_idle(void);
+
+/*
+ * Fault in the page at VADDR of AS (which must be the current address
+ * space) without loading it into the TLB; if LOCK, also lock it in
+ * memory. Used by madvise and mlock. Returns EFAULT if VADDR is not
+ * mapped or not accessible (not available with dumbvm).
+ */
+struct addrspace;
+int vm_prefault(struct addrspace *as, vaddr_t vaddr, bool lock);
+
+/*
+ * Set the fault-around window to NPAGES pages (1 turns fault-around
+ * off; not available with dumbvm).
+ */
+void vm_set_faultaround(unsigned npages);
+
+/* Print VM statistics (not available with dumbvm) */
+void vm_printstats(void);
+
+/*
+ * TLB management for the current CPU (machine-dependent; not
+ * available with dumbvm).
+ *
+ *    vm_tlb_bootstrap  - set up shootdown handling.
+ *    vm_tlb_activate   - make AS the current address space, giving it
+ *                        an address space ID on this cpu if needed.
+ *    vm_tlb_deactivate - leave no address space current for the fast
+ *                        refill path; call before the current one
+ *                        can go away.
+ *    vm_tlb_fastrefills - number of TLB misses handled by the fast
+ *                        refill path on cpu CPUNUM. Those do not
+ *                        come to vm_fault and are not counted as
+ *                        TLB misses anywhere else.
+ *    vm_tlb_flush      - invalidate every entry.
+ *    vm_tlb_flush_as   - invalidate every entry belonging to AS.
+ *    vm_tlb_load       - install VADDR -> PADDR in the current address
+ *                        space, read-only unless WRITEABLE.
+ *                        Replaces any existing entry for
+ *                        VADDR, otherwise evicts another entry if
+ *                        the TLB is full.
+ *    vm_tlb_preload    - like vm_tlb_load, but leaves an existing
+ *                        entry for VADDR alone and does not count as
+ *                        a TLB miss. For fault-around.
+ *    vm_tlb_invalidate - drop the entry for VADDR in the current
+ *                        address space, if present.
+ *    vm_tlb_shootdown  - drop the N translations in INVAL on every cpu
+ *                        that may hold them, waiting until they are
+ *                        done. One IPI per cpu covers the whole
+ *                        batch. May sleep.
+ */
+void vm_tlb_bootstrap(void);
+void vm_tlb_activate(struct addrspace *as);
+void vm_tlb_deactivate(void);
+unsigned vm_tlb_fastrefills(unsigned cpunum);
+void vm_tlb_flush(void);
+void vm_tlb_flush_as(struct addrspace *as);
+int vm_tlb_load(vaddr_t vaddr, paddr_t paddr, bool writeable);
+void vm_tlb_preload(vaddr_t vaddr, paddr_t paddr, bool writeable);
+void vm_tlb_invalidate(vaddr_t vaddr);
+void vm_tlb_shootdown(const struct tlbinval *inval, unsigned n);
+
 
 #endif /* _VM_H_ */
@@ -48,6 +48,8 @@ struct stat;
  *
  * Note: vn_fs may be null if the vnode refers to a device.
  */
+struct pagecache;
+
 struct vnode {
 	int vn_refcount;                /* Reference count */
 	struct spinlock vn_countlock;   /* Lock for vn_refcount */
@@ -57,6 +59,9 @@ struct vnode {
 	void *vn_data;                  /* Filesystem-specific data */
 
 	const struct vnode_ops *vn_ops; /* Functions on this vnode */
+
+	struct pagecache *vn_pagecache; /* Pages of mmapped file, or NULL */
+	unsigned vn_gen;                /* Bumped when contents change */
 };
 
 /*
@@ -120,9 +125,10 @@ struct vnode {
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_mmap        - Check whether the file can be mapped into
+ *                      memory; returns 0 if so. The mapping itself is
+ *                      done by the VM system through vm/pagecache.c,
+ *                      with VOP_READ and VOP_WRITE.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -231,14 +237,14 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              (vnode_write(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           (vnode_truncate(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -257,6 +263,21 @@ struct vnode_ops {
  */
 void vnode_check(struct vnode *, const char *op);
 
+/*
+ * Generation number (handled above filesystem level): changes every
+ * time the file's contents may have changed, that is, after every
+ * VOP_WRITE and VOP_TRUNCATE (which go through vnode_write and
+ * vnode_truncate for that). Lets caches of things derived from the
+ * contents (like the exec cache in loadelf.c) tell whether they are
+ * stale. The number changes once the operation is over, so whoever
+ * reads it before reading the contents either sees the contents
+ * after the change or gets a number that is stale by then.
+ */
+void vnode_modified(struct vnode *);
+unsigned vnode_getgen(struct vnode *);
+int vnode_write(struct vnode *, struct uio *);
+int vnode_truncate(struct vnode *, off_t);
+
 /*
  * Reference count manipulation (handled above filesystem level)
  */
@@ -43,6 +43,7 @@
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
+#include <kheapprof.h>
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
@@ -108,6 +109,8 @@ boot(void)
 
 	/* Early initialization. */
 	ram_bootstrap();
+	kmalloc_bootstrap();
+	lock_bootstrap();
 	err = proc_freelist_init();
 	if (err) {
 		panic("can't create process ID freelist\n");
@@ -132,6 +135,7 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	kheapprof_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -141,6 +145,10 @@ boot(void)
 	if (err) {
 		panic("can't create system filetable\n");
 	}
+	err = execv_arena_init();
+	if (err) {
+		panic("can't create execv argument buffers\n");
+	}
 
 	/*
 	 * Make sure various things aren't screwed up.
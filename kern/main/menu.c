@@ -45,8 +45,12 @@
 #include <test.h>
 #include <current.h>
 #include <syscall.h>
+#include <vm.h>
+#include <kmem_cache.h>
+#include <kheapprof.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -126,7 +130,9 @@ common_prog(int nargs, char **args)
 	if (proc == NULL) {
 		return ENOMEM;
 	}
+	spinlock_acquire(&proc_listlock);
 	proc->p_parent = curthread->t_proc;
+	spinlock_release(&proc_listlock);
 	result = thread_fork(args[0] /* thread name */,
 			proc /* new process */,
 			cmd_progthread /* thread function */,
@@ -137,7 +143,7 @@ common_prog(int nargs, char **args)
 		return result;
 	}
 
-	sys_waitpid(proc->p_id, &status, 0, &waitpid_retval);
+	proc_wait(proc->p_id, 0, &status, NULL, &waitpid_retval);
 
 	/*
 	 * The new process will be destroyed when the program exits...
@@ -471,6 +477,39 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_kheapprof(int nargs, char **args)
+{
+	if (nargs == 2) {
+		if (kheapprof_command(args[1])) {
+			kprintf("Usage: khprof [on|off|reset]\n");
+			return EINVAL;
+		}
+	}
+	else if (nargs == 1) {
+		kheapprof_print();
+	}
+	else {
+		kprintf("Usage: khprof [on|off|reset]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -500,6 +539,36 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if !OPT_DUMBVM
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	int npages;
+
+	if (nargs != 2 || (npages = atoi(args[1])) < 1) {
+		kprintf("Usage: fa npages (1 for none)\n");
+		return EINVAL;
+	}
+
+	vm_set_faultaround(npages);
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -566,6 +635,7 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[km5] Object cache test             ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -605,8 +675,14 @@ static const char *mainmenu[] = {
 	"[?o] Operations menu                ",
 	"[?t] Tests menu                     ",
 	"[kh] Kernel heap stats              ",
+	"[kc] Kernel object cache stats      ",
+	"[khprof] Kernel heap profile        ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if !OPT_DUMBVM
+	"[vm] VM stats                       ",
+	"[fa] Set VM fault-around window     ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -656,8 +732,14 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "kc",         cmd_kcachestats },
+	{ "khprof",     cmd_kheapprof },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if !OPT_DUMBVM
+	{ "vm",         cmd_vmstats },
+	{ "fa",         cmd_faultaround },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -668,6 +750,7 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "km5",	kmalloctest5 },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -49,14 +49,20 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <limits.h>
+#include <kmem_cache.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
-/* Process list head */
+/* Process list head, and its lock */
 struct proc *proc_head = NULL;
+struct spinlock proc_listlock = SPINLOCK_INITIALIZER;
+
+/* Where proc structures and PID list elements come from */
+static struct kmem_cache *proc_cache;
+static struct kmem_cache *pid_cache;
 
 /* PID counter */
 __pid_t count_pid = PID_MIN - 1;
@@ -72,13 +78,13 @@ proc_create(const char *name)
 	unsigned int fd;
 	int err_pop;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
@@ -90,6 +96,7 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+	proc->c_cwd[0] = '\0';
 
 	/* link stdin, stdout and stderr to file descriptors 0, 1, 2 */
 	proc->p_filetable[STDIN_FILENO] = sys_filetable.stdin;
@@ -101,6 +108,33 @@ proc_create(const char *name)
 		proc->p_filetable[fd] = NULL;
 	}
 
+	/* parent initialization */
+	proc->p_parent = NULL;
+
+	/* exit status initialization */
+	proc->p_exit_status = 0;
+
+	/* resource usage initialization */
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+	bzero(&proc->p_cusage, sizeof(proc->p_cusage));
+
+	/* scheduling priority initialization */
+	proc->p_nice = 0;
+
+	/*
+	 * create the locks; proc_cache has no constructor, so nothing
+	 * here may be left over from the last process in this structure
+	 */
+	proc->p_lock_active = lock_create(proc->p_name);
+	if (proc->p_lock_active == NULL) {
+		goto fail;
+	}
+	proc->p_lock_wait = lock_create(proc->p_name);
+	if (proc->p_lock_wait == NULL) {
+		lock_destroy(proc->p_lock_active);
+		goto fail;
+	}
+
 	/* process ID assignment */
 	err_pop = proc_freelist_pop(&proc->p_id);
 	if(err_pop) {
@@ -109,31 +143,32 @@ proc_create(const char *name)
 			count_pid++;
 		}
 		else {
-			kfree(proc);
-			return NULL;
+			lock_destroy(proc->p_lock_wait);
+			lock_destroy(proc->p_lock_active);
+			goto fail;
 		}
 	}
 
-
-	/* parent initialization */
-	proc->p_parent = NULL;
-
-  	/* add an element to the process list */
+  	/*
+	 * add an element to the process list, once it is all set up:
+	 * from here on others can find it
+	 */
+	spinlock_acquire(&proc_listlock);
 	proc->p_prevproc = proc_head;
 	proc->p_nextproc = NULL;
 	if(proc->p_prevproc != NULL){
 		proc->p_prevproc->p_nextproc = proc;
 	}
 	proc_head = proc;
-
-	/* exit status initialization */
-	proc->p_exit_status = 0;
-
-	/* create the locks */
-	proc->p_lock_active = lock_create(proc->p_name);
-	proc->p_lock_wait = lock_create(proc->p_name);
+	spinlock_release(&proc_listlock);
 
 	return proc;
+
+ fail:
+	spinlock_cleanup(&proc->p_lock);
+	kfree(proc->p_name);
+	kmem_cache_free(proc_cache, proc);
+	return NULL;
 }
 
 /*
@@ -145,6 +180,8 @@ proc_create(const char *name)
 void
 proc_destroy(struct proc *proc)
 {
+	struct proc *child;
+
 	/*
 	 * You probably want to destroy and null out much of the
 	 * process (particularly the address space) at exit time if
@@ -226,23 +263,31 @@ proc_destroy(struct proc *proc)
 	}
 
   	/* remove an element from the process list */
-	if(proc->p_prevproc == NULL){	/* removing the tail */
-		proc->p_nextproc->p_prevproc = NULL;
-	}
-	else if(proc->p_nextproc == NULL){	/* removing the head */
-		proc->p_prevproc->p_nextproc = NULL;
+	spinlock_acquire(&proc_listlock);
+	if(proc->p_nextproc == NULL){	/* removing the head */
+		proc_head = proc->p_prevproc;
 	}
-	else{	/* removing a middle node */
+	else{
 		proc->p_nextproc->p_prevproc = proc->p_prevproc;
+	}
+	if(proc->p_prevproc != NULL){	/* not the tail */
 		proc->p_prevproc->p_nextproc = proc->p_nextproc;
 	}
 
+	/* its children, if any are left, no longer have a parent */
+	for(child = proc_head; child != NULL; child = child->p_prevproc){
+		if(child->p_parent == proc){
+			child->p_parent = NULL;
+		}
+	}
+	spinlock_release(&proc_listlock);
+
 	/* destroy the locks */
 	lock_destroy(proc->p_lock_active);
 	lock_destroy(proc->p_lock_wait);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -251,6 +296,9 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				       NULL, NULL);
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -349,6 +397,24 @@ proc_remthread(struct thread *t)
 	splx(spl);
 }
 
+/*
+ * Accumulate resource usage, e.g. of a child into its parent's
+ * children totals. The peak resident set is the largest of the two.
+ */
+void
+proc_usage_add(struct proc_usage *to, const struct proc_usage *from)
+{
+	to->pu_utime += from->pu_utime;
+	to->pu_stime += from->pu_stime;
+	to->pu_minflt += from->pu_minflt;
+	to->pu_majflt += from->pu_majflt;
+	to->pu_tlbrefill += from->pu_tlbrefill;
+	to->pu_cowcopies += from->pu_cowcopies;
+	if (from->pu_maxrss > to->pu_maxrss) {
+		to->pu_maxrss = from->pu_maxrss;
+	}
+}
+
 /*
  * Fetch the address space of (the current) process.
  *
@@ -396,7 +462,10 @@ proc_setas(struct addrspace *newas)
 int
 proc_freelist_init(void)
 {
-	pid_list_head = (struct pid_list_elem *) kmalloc(sizeof(struct pid_list_elem));
+	pid_cache = kmem_cache_create("pid_list_elem",
+				      sizeof(struct pid_list_elem), NULL, NULL);
+
+	pid_list_head = kmem_cache_alloc(pid_cache);
 	if(pid_list_head == NULL){
 		return ENOMEM;
 	}
@@ -411,7 +480,7 @@ proc_freelist_push(__pid_t *pushpid)
 {
 	struct pid_list_elem *push_elem;
 
-	push_elem = (struct pid_list_elem *) kmalloc(sizeof(struct pid_list_elem));
+	push_elem = kmem_cache_alloc(pid_cache);
 	if(push_elem == NULL){
 		return ENOMEM;
 	}
@@ -435,7 +504,7 @@ proc_freelist_pop(__pid_t *poppid)
 	}
 	pid_list_head = pop_elem->prev_elem;
 
-	kfree(pop_elem);
+	kmem_cache_free(pid_cache, pop_elem);
 
 	return 0;
 }
@@ -59,48 +59,48 @@ int sys_open(userptr_t filename, int flags, int *retfd)
     int fd, err;
     mode_t mode;
     char *kfilename = NULL;
-    size_t filename_len;
 
-    filename_len = strlen((char *) filename);
-
-    /* check if the filename is a valid buffer in userspace */
-    if (check_buffer(filename, filename_len)) {
-        return EFAULT;
-    }
-
-    /* copy filename into kernel memory space */
-    kfilename = kstrdup((char *)filename);
-    /* if kstrdup fails to find enough memory return ENOMEM error */
+    /* if kmalloc fails to find enough memory return ENOMEM error */
+    kfilename = kmalloc(PATH_MAX);
     if (kfilename == NULL)
     {
         return ENOMEM;
     }
 
-    /* allocate space on the heap for a file table entry */
-    file = (struct fs_file *) kmalloc(sizeof(struct fs_file));
+    /*
+    * copy filename into kernel memory space: this also checks that it is a
+    * valid string in userspace (EFAULT) and not too long (ENAMETOOLONG)
+    */
+    err = copyinstr(filename, kfilename, PATH_MAX, NULL);
+    if (err)
+    {
+        kfree(kfilename);
+        return err;
+    }
+
+    /* allocate a file table entry, with its lock already created */
+    file = filetable_allocfile();
     if (file == NULL)
     {
+        kfree(kfilename);
         return ENOMEM;
     }
 
     mode = 0644;
     /* get vnode for the file */
     err = vfs_open(kfilename, flags, mode, &file_vnode);
+    kfree(kfilename);
     if (err)
     {
+        filetable_freefile(file);
         return err;
     }
 
     /* initialize filetable entry */
     file->f_vnode = file_vnode;
     file->f_offset = 0;
-    file->f_lock = false;
     file->f_refcount = 1;
-    file->f_mode = mode;
-    file->f_lock = lock_create(kfilename);
-    if (file->f_lock == NULL) {
-        return ENOMEM;
-    }
+    file->f_mode = flags & O_ACCMODE;
 
     /* add file to system filetable */
     filetable_addfile(file);
@@ -442,12 +442,10 @@ sys___getcwd (char *buf, size_t size, int *retval)
     struct uio userio;  
     struct iovec iov;
 
-    userptr_t bufend = (userptr_t) (buf + size);
-    if (buf == NULL || (bufend >= (userptr_t) USERSPACETOP)) {
-        return EFAULT;
-    }
-    (void)retval;
-    // TODO: usa checkbuffer per fare questo controllo
+    /*
+    * no need to check buf here: the uio below goes through copyout, which
+    * returns EFAULT if it is not a valid user buffer
+    */
 
     /* initialize io vector to point to user buffer and have correct length */
     iov.iov_ubase = (userptr_t) buf;
@@ -474,8 +472,14 @@ sys___getcwd (char *buf, size_t size, int *retval)
         *retval = -1;
         return error;
     } else {
-        //null termination
-        buf[size - userio.uio_resid] = 0;
+        //null termination, if there is room for it
+        if (userio.uio_resid > 0) {
+            error = copyout("", (userptr_t) (buf + size - userio.uio_resid), 1);
+            if (error) {
+                *retval = -1;
+                return error;
+            }
+        }
 
         //return the length of returned data
         *retval = size - userio.uio_resid;
@@ -490,16 +494,28 @@ int
 sys_chdir(char *pathname, int *retval) 
 {
     int error;
-    char *kpath;
+    char *kpath, *kcwd;
 
-    userptr_t pathname_end = (userptr_t) (pathname + strlen(pathname));
-    if (pathname == NULL || (pathname_end >= (userptr_t) USERSPACETOP)) {
-        return EFAULT;
+    /* copy pathname into kernel space, checking it on the way */
+    kpath = kmalloc(PATH_MAX);
+    if (kpath == NULL) {
+        return ENOMEM;
+    }
+    error = copyinstr((userptr_t) pathname, kpath, PATH_MAX, NULL);
+    if (error) {
+        kfree(kpath);
+        return error;
+    }
+
+    /* vfs_chdir may modify the path: keep a copy to update the cwd with */
+    kcwd = kstrdup(kpath);
+    if (kcwd == NULL) {
+        kfree(kpath);
+        return ENOMEM;
     }
 
-    //TODO: return errors as man page
-    kpath = kstrdup(pathname);
     error = vfs_chdir(kpath);
+    kfree(kpath);
     /*
     *  errors during the chdir operation
     *  err = 0 : no errors during VOP_WRITE
@@ -510,11 +526,13 @@ sys_chdir(char *pathname, int *retval)
     *  err = EFAULT	: pathname was an invalid pointer
     */
     if (error) {
+        kfree(kcwd);
         *retval = -1;
         return error;
     } else {
         // save pathname in the variable of the current process
-        set_cwd_from_path(curproc->c_cwd, pathname, strlen(pathname));
+        set_cwd_from_path(curproc->c_cwd, kcwd, strlen(kcwd));
+        kfree(kcwd);
         *retval = 0;
     }
 
@@ -42,8 +42,12 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
+ * Without dumbvm, segments are not copied in here at all: each one is
+ * attached to its region with as_define_backing and its pages are read
+ * from the executable by vm_fault the first time they are touched.
+ *
+ * The headers of recently run executables are kept in the exec cache
+ * below, so that running one again does not read them again.
  *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
@@ -60,6 +64,7 @@
 #include <vnode.h>
 #include <elf.h>
 
+#if OPT_DUMBVM
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -144,23 +149,70 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#endif
 
 /*
- * Load an ELF executable user program into the current address space.
+ * The part of an executable's headers load_elf needs: the entry point
+ * and the loadable segments. Executables normally have two or three;
+ * ones with more than ELF_MAXSEGS are not supported.
+ */
+#define ELF_MAXSEGS 8
+
+struct elf_segment {
+	off_t es_offset;	/* where in the file */
+	vaddr_t es_vaddr;	/* where in memory */
+	size_t es_memsz;	/* size in memory */
+	size_t es_filesz;	/* size in the file */
+	uint32_t es_flags;	/* PF_R, PF_W, PF_X */
+};
+
+struct elf_info {
+	vaddr_t ei_entry;
+	unsigned ei_nsegs;
+	struct elf_segment ei_segs[ELF_MAXSEGS];
+};
+
+/*
+ * Exec cache. Running the same program over and over (as the shell
+ * does in a loop) would otherwise read and check its headers again
+ * every time. So we remember the parsed headers of the last
+ * ELFCACHE_SIZE executables, keyed by vnode and by the vnode's
+ * generation (see vnode.h), which changes whenever the file is
+ * written or truncated and so makes a stale entry miss.
  *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * An entry does not hold a reference to its vnode, which would keep
+ * an unlinked executable's storage allocated until the entry aged
+ * out. Instead, vnode_cleanup calls load_elf_forget when the vnode is
+ * reclaimed, so an entry can't outlive its vnode and match another
+ * file that reuses the address. The oldest entry is replaced when the
+ * cache is full.
  */
+#define ELFCACHE_SIZE 8
+
+struct elfcache_entry {
+	struct vnode *ec_vnode;		/* NULL if unused */
+	unsigned ec_gen;		/* vnode generation when read */
+	unsigned ec_lastuse;		/* for replacement */
+	struct elf_info ec_info;
+};
+
+static struct spinlock elfcache_lock = SPINLOCK_INITIALIZER;
+static struct elfcache_entry elfcache[ELFCACHE_SIZE];
+static unsigned elfcache_clock;
+
+/*
+ * Read the headers of executable V into EI, checking them.
+ */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+elf_readinfo(struct vnode *v, struct elf_info *ei)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
+	struct elf_segment *es;
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
-
-	as = proc_getas();
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -202,13 +254,12 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return ENOEXEC;
 	}
 
+	ei->ei_entry = eh.e_entry;
+	ei->ei_nsegs = 0;
+
 	/*
-	 * Go through the list of segments and set up the address space.
-	 *
-	 * Ordinarily there will be one code segment, one read-only
-	 * data segment, and one data/bss segment, but there might
-	 * conceivably be more. You don't need to support such files
-	 * if it's unduly awkward to do so.
+	 * Go through the list of segments and collect the loadable
+	 * ones.
 	 *
 	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is
 	 * mandated by the ELF standard - we use sizeof(ph) to load,
@@ -243,54 +294,161 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
-		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
-		if (result) {
-			return result;
+		if (ei->ei_nsegs == ELF_MAXSEGS) {
+			kprintf("loadelf: more than %d segments\n",
+				ELF_MAXSEGS);
+			return ENOEXEC;
 		}
+		es = &ei->ei_segs[ei->ei_nsegs++];
+		es->es_offset = ph.p_offset;
+		es->es_vaddr = ph.p_vaddr;
+		es->es_memsz = ph.p_memsz;
+		es->es_filesz = ph.p_filesz;
+		es->es_flags = ph.p_flags;
 	}
 
-	result = as_prepare_load(as);
+	return 0;
+}
+
+/*
+ * Get the headers of executable V into EI, from the exec cache if
+ * they are there and otherwise from the file, adding them to the
+ * cache.
+ */
+static
+int
+elf_getinfo(struct vnode *v, struct elf_info *ei)
+{
+	struct elfcache_entry *ec, *victim;
+	unsigned gen, i;
+	int result;
+
+	/* Before reading the headers; see vnode_getgen in vnode.h. */
+	gen = vnode_getgen(v);
+
+	spinlock_acquire(&elfcache_lock);
+	for (i = 0; i < ELFCACHE_SIZE; i++) {
+		ec = &elfcache[i];
+		if (ec->ec_vnode == v && ec->ec_gen == gen) {
+			ec->ec_lastuse = ++elfcache_clock;
+			*ei = ec->ec_info;
+			spinlock_release(&elfcache_lock);
+			DEBUG(DB_EXEC, "ELF: headers from the exec cache\n");
+			return 0;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+
+	result = elf_readinfo(v, ei);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * Now actually load each segment.
+	 * Replace the entry for an older generation of V if there is
+	 * one, else an unused entry, else the one used longest ago.
+	 * (Someone else may have just done the same; then we replace
+	 * their entry with an identical one.) Our caller's reference
+	 * keeps V from being reclaimed until we're done.
 	 */
+	spinlock_acquire(&elfcache_lock);
+	victim = &elfcache[0];
+	for (i = 0; i < ELFCACHE_SIZE; i++) {
+		ec = &elfcache[i];
+		if (ec->ec_vnode == v) {
+			victim = ec;
+			break;
+		}
+		if (victim->ec_vnode != NULL &&
+		    (ec->ec_vnode == NULL ||
+		     ec->ec_lastuse < victim->ec_lastuse)) {
+			victim = ec;
+		}
+	}
+	victim->ec_vnode = v;
+	victim->ec_gen = gen;
+	victim->ec_lastuse = ++elfcache_clock;
+	victim->ec_info = *ei;
+	spinlock_release(&elfcache_lock);
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
+	return 0;
+}
 
-		result = VOP_READ(v, &ku);
+void
+load_elf_forget(struct vnode *v)
+{
+	unsigned i;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i = 0; i < ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode == v) {
+			elfcache[i].ec_vnode = NULL;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+}
+
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct elf_info ei;
+	struct elf_segment *es;
+	int result;
+	unsigned i;
+	struct addrspace *as;
+
+	as = proc_getas();
+
+	result = elf_getinfo(v, &ei);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Set up the address space.
+	 *
+	 * Ordinarily there will be one code segment, one read-only
+	 * data segment, and one data/bss segment, but there might
+	 * conceivably be more.
+	 */
+
+	for (i=0; i<ei.ei_nsegs; i++) {
+		es = &ei.ei_segs[i];
+		result = as_define_region(as,
+					  es->es_vaddr, es->es_memsz,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
 		if (result) {
 			return result;
 		}
+	}
 
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
+	result = as_prepare_load(as);
+	if (result) {
+		return result;
+	}
 
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n",
-				ph.p_type);
-			return ENOEXEC;
-		}
+	/*
+	 * Now actually load each segment.
+	 */
 
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+	for (i=0; i<ei.ei_nsegs; i++) {
+		es = &ei.ei_segs[i];
+#if OPT_DUMBVM
+		result = load_segment(as, v, es->es_offset, es->es_vaddr,
+				      es->es_memsz, es->es_filesz,
+				      es->es_flags & PF_X);
+#else
+		/* vm_fault reads the pages in on first touch */
+		result = as_define_backing(as, v, es->es_offset, es->es_vaddr,
+					   es->es_filesz);
+#endif
 		if (result) {
 			return result;
 		}
@@ -301,7 +459,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = ei.ei_entry;
 
 	return 0;
 }
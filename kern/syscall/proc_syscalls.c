@@ -31,6 +31,7 @@
 #include <syscall.h>
 #include <current.h>
 #include <proc.h>
+#include <thread.h>
 #include <limits.h>
 #include <addrspace.h>
 #include <kern/errno.h>
@@ -38,6 +39,10 @@
 #include <mips/trapframe.h>
 #include <synch.h>
 #include <copyinout.h>
+#include <clock.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include "opt-dumbvm.h"
 
 static const char *arg_padding[] = {"", "\0", "\0\0", "\0\0\0"};
 
@@ -60,8 +65,15 @@ sys_getpid(int *retpid)
 int
 sys_getppid(int *retpid)
 {
-    /* return process ID in retpid parameter */
-    *retpid = (int) curproc->p_parent->p_id;
+    /* return process ID in retpid parameter; orphans belong to the kernel */
+    spinlock_acquire(&proc_listlock);
+    if (curproc->p_parent != NULL) {
+        *retpid = (int) curproc->p_parent->p_id;
+    }
+    else {
+        *retpid = (int) kproc->p_id;
+    }
+    spinlock_release(&proc_listlock);
 
     /* this system call is always successful */
     return 0;
@@ -84,15 +96,18 @@ sys_fork(struct trapframe *tf, int *retval){
     /* create child process */
     child = proc_create_runprogram(curproc->p_name);
     if (pid_list_head->pid == -1 && count_pid == PID_MAX) {
+        kfree(child_tf);
         return ENPROC;
     }
 	if (child == NULL) {
+		kfree(child_tf);
 		return ENOMEM;
 	}
 
     /* set address space */
     as_copy(curproc->p_addrspace, &child->p_addrspace);
 	if (child->p_addrspace == NULL) {
+		kfree(child_tf);
 		return ENOMEM;
 	}
 
@@ -105,7 +120,12 @@ sys_fork(struct trapframe *tf, int *retval){
 	}
 
     /* set curproc as parent */
+    spinlock_acquire(&proc_listlock);
     child->p_parent = curproc;
+    spinlock_release(&proc_listlock);
+
+    /* the child runs at the parent's priority */
+    child->p_nice = curproc->p_nice;
 
     /* create new thread starting from parent */
     thread_fork(child->p_name, child, enter_forked_process, (void *)child_tf, 1);
@@ -116,101 +136,199 @@ sys_fork(struct trapframe *tf, int *retval){
     return 0;
 }
 
+/*
+* execv marshals the arguments in an arena of ARG_MAX bytes, plus room
+* for the program name, taken from a small pool instead of kmalloc'ing
+* and freeing a large buffer on every exec. At most EXECV_NARENAS are
+* ever allocated, the first time they are needed, and kept for reuse;
+* an exec that finds them all in use waits for one.
+*/
+#define EXECV_NARENAS 2
+#define EXECV_ARENA_SIZE (ARG_MAX + PATH_MAX)
+
+static struct lock *execv_arena_lock;
+static struct cv *execv_arena_cv;
+static char *execv_freearenas[EXECV_NARENAS];
+static unsigned execv_nfree;    /* arenas in execv_freearenas */
+static unsigned execv_narenas;  /* arenas allocated so far */
+
 int
-sys_execv(userptr_t prog, userptr_t args)
+execv_arena_init(void)
 {
-    char *kprogname;
-    size_t prog_len;
-    /*
-    * this is just a cast from a userptr_t to a double pointer to char
-    * so that we can use [] and treat it as if it was the usual argv
-    */
-    char **argv = (char **) args;
-    /*
-    * kbuf is the kernel buffer where we put everything
-    * kbuf_ptr_begin points to the beginning of the data (arguments)
-    * kbuf_ptr is moved while copying the arguments that are passed
-    */
-    char **kbuf, *kbuf_ptr, *kbuf_ptr_begin;
-    size_t kbuf_size;
-    int result;
-    int i = 0;
-    size_t args_size = 0, arg_size, padding_size;
-    int argc = 0;
-    struct vnode *v;
-    struct addrspace *as, *old_as;
-    vaddr_t entrypoint, stackptr, stackptr_data, stackptr_argv;
+    execv_arena_lock = lock_create("execv arena");
+    if (execv_arena_lock == NULL) {
+        return ENOMEM;
+    }
+    execv_arena_cv = cv_create("execv arena");
+    if (execv_arena_cv == NULL) {
+        lock_destroy(execv_arena_lock);
+        return ENOMEM;
+    }
+    return 0;
+}
+
+static
+char *
+execv_arena_get(void)
+{
+    char *arena;
 
-    /* if program name is an invalid buffer */
-    prog_len = strlen((char *) prog);
-    if (check_buffer(prog, prog_len)) {
-        return EFAULT;
+    lock_acquire(execv_arena_lock);
+    while (execv_nfree == 0 && execv_narenas == EXECV_NARENAS) {
+        cv_wait(execv_arena_cv, execv_arena_lock);
     }
-    /* copy program name into kernel space */
-    kprogname = kstrdup((char *) prog);
+    if (execv_nfree > 0) {
+        arena = execv_freearenas[--execv_nfree];
+        lock_release(execv_arena_lock);
+        return arena;
+    }
+    /* none free but we may have another one: allocate it */
+    execv_narenas++;
+    lock_release(execv_arena_lock);
+
+    arena = kmalloc(EXECV_ARENA_SIZE);
+    if (arena == NULL) {
+        lock_acquire(execv_arena_lock);
+        execv_narenas--;
+        cv_signal(execv_arena_cv, execv_arena_lock);
+        lock_release(execv_arena_lock);
+    }
+    return arena;
+}
 
-    /* here we copy the arguments to kernel space */
+static
+void
+execv_arena_put(char *arena)
+{
+    lock_acquire(execv_arena_lock);
+    KASSERT(execv_nfree < execv_narenas);
+    execv_freearenas[execv_nfree++] = arena;
+    cv_signal(execv_arena_cv, execv_arena_lock);
+    lock_release(execv_arena_lock);
+}
 
-    /* count number of arguments */
-    while (argv[argc] != NULL && args_size <= ARG_MAX){
-        arg_size = strlen(argv[argc]) + 1;
-        if (check_buffer((userptr_t) argv[argc], arg_size)) {
-            return EFAULT;
+/*
+* Copy the NULL-terminated user vector ARGS and the strings it points
+* to into ARENA, in one pass over each string, and lay them out there
+* the way they go on the new user stack: the strings, each padded to a
+* multiple of 4 bytes, then argv. The argv entries are left as offsets
+* of the strings from the start of the arena; the caller adds where the
+* block ends up. Everything, argv included, must fit in ARG_MAX bytes.
+* Returns the number of arguments in *RETARGC and the size of the
+* strings, which is where argv starts, in *RETARGSSIZE.
+*/
+static
+int
+execv_copyargs(userptr_t args, char *arena, int *retargc,
+               size_t *retargssize)
+{
+    /*
+    * while copying, the strings grow up from the start of the arena and
+    * their offsets are stored in words growing down from ARG_MAX, so the
+    * offset of argument i is in kvec[-1 - i]
+    */
+    vaddr_t *kvec = (vaddr_t *)(arena + ARG_MAX);
+    vaddr_t *kargv, tmp;
+    userptr_t uarg;
+    size_t args_size = 0, arg_size, padding_size, vec_size;
+    int argc = 0;
+    int i, result;
+
+    while (1) {
+        /* fetch argv[argc] itself... */
+        result = copyin(args + argc * sizeof(userptr_t), &uarg,
+                        sizeof(userptr_t));
+        if (result) {
+            return result;
         }
-        if (arg_size % 4 == 0) {
-            /* no need for padding */
-            padding_size = 0;
-        } else {
-            /* need for padding */
-            padding_size = 4 - (arg_size % 4);
+        if (uarg == NULL) {
+            break;
         }
+        /* room for this argument's word and the final NULL */
+        vec_size = sizeof(vaddr_t) * (argc + 2);
+        if (args_size + vec_size >= ARG_MAX) {
+            return E2BIG;
+        }
+        /* ...and then the string it points to, right into place */
+        result = copyinstr(uarg, arena + args_size,
+                           ARG_MAX - vec_size - args_size, &arg_size);
+        if (result) {
+            /* size of arguments is too large */
+            return result == ENAMETOOLONG ? E2BIG : result;
+        }
+        padding_size = (4 - arg_size % 4) % 4;
+        /* size of arguments (with padding) is too large */
+        if (args_size + arg_size + padding_size + vec_size > ARG_MAX) {
+            return E2BIG;
+        }
+        memcpy(arena + args_size + arg_size, arg_padding[padding_size],
+               padding_size);
+        kvec[-1 - argc] = args_size;
         args_size += arg_size + padding_size;
         argc++;
     }
 
-    /* size of arguments (with padding) is too large */
-    if (args_size > ARG_MAX) {
-        return E2BIG;
+    /*
+    * the offsets are in reverse order at the end of the arena: put them
+    * in order, move them down to right after the strings (the areas may
+    * overlap) and terminate the vector
+    */
+    for (i = 0; i < argc / 2; i++) {
+        tmp = kvec[-1 - i];
+        kvec[-1 - i] = kvec[i - argc];
+        kvec[i - argc] = tmp;
     }
+    kargv = (vaddr_t *)(arena + args_size);
+    memmove(kargv, kvec - argc, sizeof(vaddr_t) * argc);
+    kargv[argc] = 0;
 
+    *retargc = argc;
+    *retargssize = args_size;
+    return 0;
+}
+
+int
+sys_execv(userptr_t prog, userptr_t args)
+{
     /*
-    * kbuf must be big enough to accomodate the args with padding and an
-    * initial pointer to the data which is made of (argc + 1) words
+    * arena holds the arguments as they will be copied out, see
+    * execv_copyargs, and after ARG_MAX the program name
     */
-    kbuf_size = sizeof(char) * args_size + sizeof(char *) * (argc + 1);
-    /* allocate the buffer in the kernel heap */
-    kbuf  = (char **) kmalloc(kbuf_size);
-    /* point to the part where you will store the data (padded args) */
-    kbuf_ptr_begin = (char *) (kbuf + argc + 1);
-    /* copy the pointer so that you do not lose reference to the beginning */
-    kbuf_ptr = kbuf_ptr_begin;
-
-    /* for each argument ... */
-    for (i = 0; i < argc; i++) {
-        /* set the vector entry i to the value of the ptr where first arg begins */
-        kbuf[i] = kbuf_ptr;
-        /* compute arg size and check if it needs padding */
-        arg_size = strlen(argv[i]) + 1;
-        if (arg_size % 4 == 0) {
-            padding_size = 0;
-        } else {
-            padding_size = 4 - (arg_size % 4);
-        }
-        /* copy the argument into the data part of the kernel buffer */
-        copyin((userptr_t) argv[i], kbuf_ptr, arg_size);
-        kbuf_ptr += arg_size;
-        /* if there is padding to do, concatenate the padding string */
-        if (padding_size > 0) {
-            memcpy(kbuf_ptr, arg_padding[padding_size], padding_size);
-        }
-        kbuf_ptr += padding_size;
+    char *arena, *kprogname;
+    vaddr_t *kargv;
+    size_t args_size, block_size;
+    int result;
+    int i, argc;
+    struct vnode *v;
+    struct addrspace *as, *old_as;
+    vaddr_t entrypoint, stackptr, stackptr_data, stackptr_argv;
+
+    arena = execv_arena_get();
+    if (arena == NULL) {
+        return ENOMEM;
+    }
+    kprogname = arena + ARG_MAX;
+
+    /* copy program name into kernel space (fails with EFAULT if invalid) */
+    result = copyinstr(prog, kprogname, PATH_MAX, NULL);
+    if (result) {
+        execv_arena_put(arena);
+        return result;
     }
-    /* last element of the reference vector must be null also in kern buffer */
-    kbuf[argc] = NULL;
+
+    /* here we copy the arguments to kernel space, counting them */
+    result = execv_copyargs(args, arena, &argc, &args_size);
+    if (result) {
+        execv_arena_put(arena);
+        return result;
+    }
+    kargv = (vaddr_t *) (arena + args_size);
+    block_size = args_size + sizeof(vaddr_t) * (argc + 1);
 
     /* open ELF file */
     result = vfs_open(kprogname, O_RDONLY, 0, &v);
     if (result) {
+        execv_arena_put(arena);
         return result;
     }
 
@@ -219,6 +337,7 @@ sys_execv(userptr_t prog, userptr_t args)
     old_as = curproc->p_addrspace;
 	if (as == NULL) {
 		vfs_close(v);
+		execv_arena_put(arena);
 		return ENOMEM;
 	}
 
@@ -230,7 +349,10 @@ sys_execv(userptr_t prog, userptr_t args)
     result = load_elf(v, &entrypoint);
     if (result) {
         proc_setas(old_as);
+        as_activate();
+        as_destroy(as);
         vfs_close(v);
+        execv_arena_put(arena);
         return result;
     }
 
@@ -240,39 +362,41 @@ sys_execv(userptr_t prog, userptr_t args)
     /* define user stack in the new address space: simply assigns stackptr to 0x80000000 */
     result = as_define_stack(as, &stackptr);
     if (result) {
+        proc_setas(old_as);
+        as_activate();
+        as_destroy(as);
+        execv_arena_put(arena);
         return result;
     }
 
     /*
-    * the buffer will start at top of stack - the size of the buffer that we need to
-    * load into the new userspace
-    */
-    stackptr_argv = stackptr - kbuf_size;
-    /* the data segment of the userspace buffer starts (argc + 1) words later */
-    stackptr_data = stackptr_argv + sizeof(char *) * (argc + 1);
-    /*
-    * NOTE! Before copying everything brutally into the new userspace, we need to
-    * change the references so that they point to where things will be copied
-    * into the userspace
+    * the block goes at the top of the stack, strings first and argv
+    * after them, keeping the stack pointer 8-aligned; now that we know
+    * where the strings will be, make the argv entries point there
     */
+    stackptr_data = (stackptr - block_size) & ~(vaddr_t)7;
+    stackptr_argv = stackptr_data + args_size;
     for (i = 0; i < argc; i++) {
-        /*
-        * This is just a mapping between kernel buffer and addrspace buffer:
-        * compute the delta between where argv[i] starts and where the data segment
-        * starts in the kernel buffer. Add this delta to where the data segment
-        * starts in the userspace
-        */
-        kbuf[i] = (kbuf[i] - kbuf_ptr_begin) + (char *) stackptr_data;
+        kargv[i] += stackptr_data;
     }
 
-    /* now we can copy everything brutally as the references will be correct! */
-    copyout(kbuf, (userptr_t) stackptr_argv, kbuf_size);
-    /* free the memory allocated in the kernel heap */
-    kfree(kbuf);
-    kfree(kprogname);
+    /* copy everything into the new userspace at once */
+    result = copyout(arena, (userptr_t) stackptr_data, block_size);
+    execv_arena_put(arena);
+    if (result) {
+        proc_setas(old_as);
+        as_activate();
+        as_destroy(as);
+        return result;
+    }
+
+    /* the old address space is not needed anymore: give its memory back */
+    if (old_as != NULL) {
+        as_destroy(old_as);
+    }
 
     /* switch to user mode */
-    enter_new_process(argc, (userptr_t) stackptr_argv, NULL, stackptr_argv, entrypoint);
+    enter_new_process(argc, (userptr_t) stackptr_argv, NULL, stackptr_data, entrypoint);
     panic("enter_new_process returned in execv\n");
     return EINVAL;
 }
@@ -309,49 +433,236 @@ sys__exit(int status)
 }
 
 /*
-* System call interface function to wait for a process to terminate given its identifier
+* Take a snapshot of the resource usage of process p, and of the number of
+* pages it has resident right now (0 for a process without an address space,
+* or with dumbvm, which does not keep track)
+*/
+static
+void
+proc_getusage(struct proc *p, struct proc_usage *usage, unsigned *rss)
+{
+    *usage = p->p_usage;
+    *rss = 0;
+#if !OPT_DUMBVM
+    spinlock_acquire(&p->p_lock);
+    if (p->p_addrspace != NULL) {
+        *rss = p->p_addrspace->as_rss;
+    }
+    spinlock_release(&p->p_lock);
+#endif
+    /* pages a child got at fork time do not go through vm_fault */
+    if (*rss > usage->pu_maxrss) {
+        usage->pu_maxrss = *rss;
+    }
+}
+
+/*
+* Convert the usage counters into a struct rusage (times from hardclocks,
+* memory from pages to kilobytes)
+*/
+static
+void
+rusage_fill(struct rusage *ru, const struct proc_usage *usage, unsigned rss)
+{
+    bzero(ru, sizeof(*ru));
+    ru->ru_utime.tv_sec = usage->pu_utime / HZ;
+    ru->ru_utime.tv_usec = (usage->pu_utime % HZ) * (1000000 / HZ);
+    ru->ru_stime.tv_sec = usage->pu_stime / HZ;
+    ru->ru_stime.tv_usec = (usage->pu_stime % HZ) * (1000000 / HZ);
+    ru->ru_maxrss = usage->pu_maxrss * (PAGE_SIZE / 1024);
+    ru->ru_minflt = usage->pu_minflt;
+    ru->ru_majflt = usage->pu_majflt;
+    ru->ru_rss = rss * (PAGE_SIZE / 1024);
+    ru->ru_tlbrefill = usage->pu_tlbrefill;
+    ru->ru_cowcopies = usage->pu_cowcopies;
+}
+
+/*
+* System call interface function to get the resource usage of the current
+* process (RUSAGE_SELF) or of its children that have been waited for
+* (RUSAGE_CHILDREN)
+*/
+int
+sys_getrusage(int who, userptr_t usage)
+{
+    struct rusage ru;
+    struct proc_usage pu;
+    unsigned rss;
+
+    if (who == RUSAGE_SELF) {
+        proc_getusage(curproc, &pu, &rss);
+    } else if (who == RUSAGE_CHILDREN) {
+        pu = curproc->p_cusage;
+        rss = 0;
+    } else {
+        return EINVAL;
+    }
+
+    rusage_fill(&ru, &pu, rss);
+    return copyout(&ru, usage, sizeof(ru));
+}
+
+/*
+* Find the process whose priority getpriority/setpriority refer to: only
+* single processes (PRIO_PROCESS) are supported, with 0 meaning the caller.
+* Call with proc_listlock held, which keeps the process from going away
 */
+static
 int
-sys_waitpid(__pid_t pid, int *status, int options, int *retval)
+priority_target(int which, int who, struct proc **ret)
 {
     struct proc *searchproc = proc_head;
-    struct proc *foundproc = NULL;
-    int tryval;
 
-    /* currently no options are supported */
-    if(options != 0 && options != WNOHANG){
+    KASSERT(spinlock_do_i_hold(&proc_listlock));
+
+    if (which != PRIO_PROCESS) {
         return EINVAL;
     }
+    if (who == 0) {
+        *ret = curproc;
+        return 0;
+    }
 
-    /* check if pid argument is the identifier of an existing process*/
-    while(searchproc != NULL){
-        if(searchproc->p_id == pid){
-            foundproc = searchproc;
-            searchproc = NULL;
+    while (searchproc != NULL) {
+        if (searchproc->p_id == who) {
+            *ret = searchproc;
+            return 0;
         }
-        else{
-            searchproc = searchproc->p_prevproc;
+        searchproc = searchproc->p_prevproc;
+    }
+    return ESRCH;
+}
+
+/*
+* System call interface function to get the scheduling priority (nice
+* value) of a process
+*/
+int
+sys_getpriority(int which, int who, int *retval)
+{
+    struct proc *p;
+    int result;
+
+    spinlock_acquire(&proc_listlock);
+    result = priority_target(which, who, &p);
+    if (result == 0) {
+        *retval = p->p_nice;
+    }
+    spinlock_release(&proc_listlock);
+
+    return result;
+}
+
+/*
+* System call interface function to set the scheduling priority (nice
+* value) of a process. Out of range values are clamped to PRIO_MIN and
+* PRIO_MAX. This decides the highest priority level the scheduler lets
+* the process's threads run at. A process may only change its own
+* priority and that of its descendants
+*/
+int
+sys_setpriority(int which, int who, int prio)
+{
+    struct proc *p, *ancestor;
+    int result;
+
+    if (prio < PRIO_MIN) {
+        prio = PRIO_MIN;
+    } else if (prio > PRIO_MAX) {
+        prio = PRIO_MAX;
+    }
+
+    spinlock_acquire(&proc_listlock);
+    result = priority_target(which, who, &p);
+    if (result == 0) {
+        ancestor = p;
+        while (ancestor != NULL && ancestor != curproc) {
+            ancestor = ancestor->p_parent;
+        }
+        if (ancestor == NULL) {
+            result = EPERM;
+        }
+        else {
+            p->p_nice = prio;
         }
     }
-    if(foundproc == NULL){
-        return ESRCH;
+    spinlock_release(&proc_listlock);
+    if (result) {
+        return result;
     }
 
-    /* check if pid argument is the identifier of a child process*/
-    if(foundproc->p_parent != curproc){
-        return ECHILD;
+    /* take effect right away for ourselves */
+    if (p == curproc) {
+        thread_reprioritize();
     }
+    return 0;
+}
 
-    /* check if status argument is a valid pointer */
-    if (status == NULL) {
-		return EFAULT;
-	}
+/*
+* Wait for the child process pid to terminate, and reap it: the kernel side
+* of waitpid and wait4, also used by the menu. On success *retval is the
+* child pid and *status its encoded exit status, and if usage is not NULL
+* *usage is what the child used. With WNOHANG and the child still running,
+* *retval is 0 and nothing else is set
+*/
+int
+proc_wait(__pid_t pid, int options, int *status, struct proc_usage *usage,
+          int *retval)
+{
+    struct proc *searchproc;
+    struct proc *foundproc = NULL;
+    struct proc_usage pu;
+    unsigned rss;
+
+    /* currently no options are supported */
+    if(options != 0 && options != WNOHANG){
+        return EINVAL;
+    }
+
+    while(1){
+        /* check if pid argument is the identifier of an existing process*/
+        spinlock_acquire(&proc_listlock);
+        foundproc = NULL;
+        searchproc = proc_head;
+        while(searchproc != NULL){
+            if(searchproc->p_id == pid){
+                foundproc = searchproc;
+                searchproc = NULL;
+            }
+            else{
+                searchproc = searchproc->p_prevproc;
+            }
+        }
+        if(foundproc == NULL){
+            spinlock_release(&proc_listlock);
+            return ESRCH;
+        }
+
+        /* check if pid argument is the identifier of a child process*/
+        if(foundproc->p_parent != curproc){
+            spinlock_release(&proc_listlock);
+            return ECHILD;
+        }
+
+        /*
+        * get the child's wait lock before letting go of the list: an exiting
+        * child takes that lock before it destroys itself, so while we hold it
+        * the child stays around. If the child has it, it is destroying itself
+        * right now; look again once it is gone
+        */
+        if(lock_tryacquire(foundproc->p_lock_wait) == 0){
+            spinlock_release(&proc_listlock);
+            break;
+        }
+        spinlock_release(&proc_listlock);
+        thread_yield();
+    }
 
-    /* acquire child locks */
-    lock_acquire(foundproc->p_lock_wait);
+    /* acquire the other child lock */
     if(options == WNOHANG){
-        tryval = lock_tryacquire(foundproc->p_lock_active);
-        if(tryval){
+        /* the child holds its active lock until it exits */
+        if(lock_tryacquire(foundproc->p_lock_active)){
+            lock_release(foundproc->p_lock_wait);
             *retval = 0;
             return 0;
         }
@@ -363,12 +674,83 @@ sys_waitpid(__pid_t pid, int *status, int options, int *retval)
     /* save child process exit status */
     *status = _MKWAIT_EXIT(foundproc->p_exit_status);
 
-    /* release child locks */
-    lock_release(foundproc->p_lock_wait);
+    /*
+    * the child is done but not destroyed yet: add up what it (and the
+    * children it waited for) used, and charge it to our children totals
+    */
+    proc_getusage(foundproc, &pu, &rss);
+    proc_usage_add(&pu, &foundproc->p_cusage);
+    proc_usage_add(&curproc->p_cusage, &pu);
+    if (usage != NULL) {
+        *usage = pu;
+    }
+
+    /*
+    * release child locks, the wait lock last: once the child gets it, it
+    * destroys both
+    */
     lock_release(foundproc->p_lock_active);
+    lock_release(foundproc->p_lock_wait);
 
     /* on success, the child pid is the return value */
     *retval = (int) pid;
 
+    return 0;
+}
+
+/*
+* System call interface function to wait for a process to terminate given its identifier
+*/
+int
+sys_waitpid(__pid_t pid, userptr_t status, int options, int *retval)
+{
+    return sys_wait4(pid, status, options, NULL, retval);
+}
+
+/*
+* System call interface function to wait for a process to terminate given its
+* identifier, also returning its resource usage (if usage is not NULL). A NULL
+* status means the caller does not want the exit status
+*/
+int
+sys_wait4(__pid_t pid, userptr_t status, int options, userptr_t usage,
+          int *retval)
+{
+    struct proc_usage pu;
+    struct rusage ru;
+    int kstatus;
+    int result;
+
+    /* check the status pointer first, so a bad one does not lose the child */
+    if (status != NULL) {
+        kstatus = 0;
+        result = copyout(&kstatus, status, sizeof(kstatus));
+        if (result) {
+            return result;
+        }
+    }
+
+    result = proc_wait(pid, options, &kstatus, &pu, retval);
+    if (result) {
+        return result;
+    }
+
+    /* WNOHANG, and the child has not exited yet */
+    if (*retval == 0) {
+        return 0;
+    }
+
+    if (status != NULL) {
+        result = copyout(&kstatus, status, sizeof(kstatus));
+        if (result) {
+            return result;
+        }
+    }
+
+    if (usage != NULL) {
+        rusage_fill(&ru, &pu, 0);
+        return copyout(&ru, usage, sizeof(ru));
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <limits.h>
+#include <addrspace.h>
+#include <pagecache.h>
+#include <fs.h>
+#include <vnode.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+
+/* pages of residency info mincore gathers per copyout */
+#define MINCORE_CHUNK 64
+
+/*
+* System call interface function to move the end of the heap (the break)
+*/
+int
+sys_sbrk(intptr_t amount, int *retval)
+{
+    struct addrspace *as;
+    vaddr_t oldbreak;
+    int err;
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+
+    /* grow or shrink the heap region; its pages come on first touch */
+    err = as_sbrk(as, amount, &oldbreak);
+    if (err) {
+        return err;
+    }
+
+    /* sbrk returns the old break */
+    *retval = (int) oldbreak;
+    return 0;
+}
+
+/*
+* System call interface function to map a file or anonymous memory
+*/
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+         off_t offset, int *retval)
+{
+    struct addrspace *as;
+    struct fs_file *file;
+    struct pagecache *pc;
+    vaddr_t vaddr;
+    unsigned perm, how;
+    int type, err;
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+
+    /* check the arguments */
+    type = flags & MAP_TYPE;
+    if (len == 0 || (type != MAP_SHARED && type != MAP_PRIVATE) ||
+        (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0 ||
+        (flags & ~(MAP_TYPE | MAP_FIXED | MAP_ANON)) != 0) {
+        return EINVAL;
+    }
+    if ((flags & MAP_FIXED) &&
+        (addr == NULL || ((vaddr_t) addr & ~PAGE_FRAME) != 0)) {
+        return EINVAL;
+    }
+    if (flags & MAP_ANON) {
+        offset = 0;
+    }
+    else if (offset < 0 || (offset & ~(off_t)PAGE_FRAME) != 0) {
+        return EINVAL;
+    }
+    if (len > USERSPACETOP) {
+        return ENOMEM;
+    }
+
+    perm = 0;
+    if (prot & PROT_READ) {
+        perm |= REGION_READ;
+    }
+    if (prot & PROT_WRITE) {
+        perm |= REGION_WRITE;
+    }
+    if (prot & PROT_EXEC) {
+        perm |= REGION_EXEC;
+    }
+
+    /* find where the pages come from */
+    pc = NULL;
+    if (flags & MAP_ANON) {
+        /* private anonymous memory is just zero-filled pages */
+        if (type == MAP_SHARED) {
+            err = pagecache_attach(NULL, &pc);
+            if (err) {
+                return err;
+            }
+        }
+    }
+    else {
+        if (fd < 0 || fd >= OPEN_MAX || curproc->p_filetable[fd] == NULL) {
+            return EBADF;
+        }
+        file = curproc->p_filetable[fd];
+
+        lock_acquire(file->f_lock);
+        /*
+        * the file must be open for reading, and for writing too if the
+        * mapping can write to it
+        */
+        how = file->f_mode & O_ACCMODE;
+        if (how == O_WRONLY ||
+            (type == MAP_SHARED && (prot & PROT_WRITE) && how != O_RDWR)) {
+            err = EACCES;
+        }
+        else {
+            /* ask the file system whether this file can be mapped */
+            err = VOP_MMAP(file->f_vnode);
+            if (err == ENOSYS) {
+                err = ENODEV;
+            }
+        }
+        if (!err) {
+            err = pagecache_attach(file->f_vnode, &pc);
+        }
+        lock_release(file->f_lock);
+        if (err) {
+            return err;
+        }
+    }
+
+    /* add the region; its pages come on first touch */
+    vaddr = (flags & MAP_FIXED) ? (vaddr_t) addr : 0;
+    err = as_mmap(as, &vaddr, ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE, perm,
+                  pc, offset, type == MAP_SHARED);
+    if (err) {
+        if (pc != NULL) {
+            pagecache_release(pc);
+        }
+        return err;
+    }
+
+    *retval = (int) vaddr;
+    return 0;
+}
+
+/*
+* System call interface function to remove mappings made with mmap
+*/
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+    struct addrspace *as;
+
+    as = proc_getas();
+    if (as == NULL || len == 0 || len > USERSPACETOP) {
+        return EINVAL;
+    }
+
+    /* dirty pages of shared file mappings are written back by the page cache */
+    return as_munmap(as, (vaddr_t) addr, ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE);
+}
+
+/*
+* Check a page-aligned user range for madvise, mincore, mlock and munlock
+* and turn it into a page count
+*/
+static
+int
+user_page_range(userptr_t addr, size_t len, vaddr_t *vaddr, size_t *npages)
+{
+    *vaddr = (vaddr_t) addr;
+    if ((*vaddr & ~PAGE_FRAME) != 0 || len == 0) {
+        return EINVAL;
+    }
+    if (*vaddr >= USERSPACETOP || len > USERSPACETOP - *vaddr) {
+        return ENOMEM;
+    }
+    *npages = ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE;
+    return 0;
+}
+
+/*
+* System call interface function to give the VM hints about how memory
+* will be used
+*/
+int
+sys_madvise(userptr_t addr, size_t len, int advice)
+{
+    struct addrspace *as;
+    vaddr_t vaddr;
+    size_t npages;
+    int err;
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+    err = user_page_range(addr, len, &vaddr, &npages);
+    if (err) {
+        return err;
+    }
+
+    return as_madvise(as, vaddr, npages, advice);
+}
+
+/*
+* System call interface function to find out which pages are resident
+*/
+int
+sys_mincore(userptr_t addr, size_t len, userptr_t vec)
+{
+    struct addrspace *as;
+    unsigned char kvec[MINCORE_CHUNK];
+    vaddr_t vaddr;
+    size_t npages, n, done;
+    int err;
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+    err = user_page_range(addr, len, &vaddr, &npages);
+    if (err) {
+        return err;
+    }
+
+    /* one byte per page, a chunk at a time */
+    for (done = 0; done < npages; done += n) {
+        n = npages - done;
+        if (n > MINCORE_CHUNK) {
+            n = MINCORE_CHUNK;
+        }
+        err = as_mincore(as, vaddr + done * PAGE_SIZE, n, kvec);
+        if (err) {
+            return err;
+        }
+        err = copyout(kvec, vec + done, n);
+        if (err) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+/*
+* System call interface function to lock pages in memory
+*/
+int
+sys_mlock(userptr_t addr, size_t len)
+{
+    struct addrspace *as;
+    vaddr_t vaddr;
+    size_t npages;
+    int err;
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+    err = user_page_range(addr, len, &vaddr, &npages);
+    if (err) {
+        return err;
+    }
+
+    return as_mlock(as, vaddr, npages);
+}
+
+/*
+* System call interface function to unlock pages locked with mlock
+*/
+int
+sys_munlock(userptr_t addr, size_t len)
+{
+    struct addrspace *as;
+    vaddr_t vaddr;
+    size_t npages;
+    int err;
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+    err = user_page_range(addr, len, &vaddr, &npages);
+    if (err) {
+        return err;
+    }
+
+    return as_munlock(as, vaddr, npages);
+}
@@ -36,6 +36,7 @@
 #include <thread.h>
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
+#include <kmem_cache.h>
 #include <test.h>
 
 #include "opt-dumbvm.h"
@@ -378,3 +379,102 @@ kmalloctest4(int nargs, char **args)
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km5
+
+/*
+ * Test object caches: allocate a few slabs' worth of objects, check
+ * that they are distinct and constructed, free them, and check that
+ * allocating them again reuses the constructed objects instead of
+ * constructing new ones.
+ */
+
+#define KM5_NOBJS	64
+#define KM5_MAGIC	0xc0ffee5
+
+struct km5obj {
+	unsigned magic;
+	struct km5obj *self;
+	char pad[200];
+};
+
+static struct kmem_cache *km5cache;
+static volatile unsigned km5ctors;
+
+static
+int
+km5ctor(void *obj)
+{
+	struct km5obj *ko = obj;
+
+	ko->magic = KM5_MAGIC;
+	ko->self = ko;
+	km5ctors++;
+	return 0;
+}
+
+static
+void
+km5dtor(void *obj)
+{
+	struct km5obj *ko = obj;
+
+	KASSERT(ko->magic == KM5_MAGIC);
+	ko->magic = 0;
+}
+
+int
+kmalloctest5(int nargs, char **args)
+{
+	struct km5obj *objs[KM5_NOBJS];
+	unsigned i, j, ctors;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting object cache test...\n");
+
+	if (km5cache == NULL) {
+		km5cache = kmem_cache_create("km5", sizeof(struct km5obj),
+					     km5ctor, km5dtor);
+	}
+
+	for (i=0; i<KM5_NOBJS; i++) {
+		objs[i] = kmem_cache_alloc(km5cache);
+		if (objs[i] == NULL) {
+			panic("kmalloctest5: out of memory\n");
+		}
+		KASSERT(objs[i]->magic == KM5_MAGIC);
+		KASSERT(objs[i]->self == objs[i]);
+		KASSERT((vaddr_t)objs[i] % sizeof(uint64_t) == 0);
+		for (j=0; j<i; j++) {
+			KASSERT(objs[j] != objs[i]);
+		}
+	}
+
+	/* free in an odd order, leaving every other object */
+	for (i=0; i<KM5_NOBJS; i+=2) {
+		kmem_cache_free(km5cache, objs[i]);
+	}
+	ctors = km5ctors;
+	for (i=0; i<KM5_NOBJS; i+=2) {
+		objs[i] = kmem_cache_alloc(km5cache);
+		if (objs[i] == NULL) {
+			panic("kmalloctest5: out of memory\n");
+		}
+		KASSERT(objs[i]->magic == KM5_MAGIC);
+		KASSERT(objs[i]->self == objs[i]);
+	}
+	if (km5ctors != ctors) {
+		panic("kmalloctest5: freed objects were not reused\n");
+	}
+
+	for (i=0; i<KM5_NOBJS; i++) {
+		kmem_cache_free(km5cache, objs[i]);
+	}
+
+	kmem_cache_printstats();
+	kprintf("Object cache test done\n");
+	return 0;
+}
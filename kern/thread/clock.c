@@ -34,6 +34,7 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 
 /*
  * Time handling.
@@ -50,7 +51,7 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	HZ	/* Boost priorities once a second. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
@@ -96,6 +97,20 @@ hardclock(void)
 	 * Collect statistics here as desired.
 	 */
 
+	/*
+	 * Charge the tick to the process that was running. An idle cpu
+	 * is still in the thread that last went to sleep on it, which
+	 * is not running.
+	 */
+	if (!curcpu->c_isidle && curthread->t_proc != NULL) {
+		if (curcpu->c_intr_user) {
+			curthread->t_proc->p_usage.pu_utime++;
+		}
+		else {
+			curthread->t_proc->p_usage.pu_stime++;
+		}
+	}
+
 	curcpu->c_hardclocks++;
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
@@ -103,7 +118,9 @@ hardclock(void)
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	if (thread_charge_tick()) {
+		thread_yield();
+	}
 }
 
 /*
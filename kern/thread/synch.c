@@ -33,11 +33,13 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <kmem_cache.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -138,39 +140,82 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+static struct kmem_cache *lock_cache;
+
+/*
+ * Constructor and destructor for the lock cache. A free lock keeps its
+ * wait channel, which is named by lk_namebuf so that it follows the
+ * name of whoever has the lock next.
+ */
+static
+int
+lock_ctor(void *obj)
+{
+        struct lock *lock = obj;
+
+        lock->lk_namebuf[0] = '\0';
+        lock->lk_name = lock->lk_namebuf;
+        /* create wait channel (list of waiting threads) named as the lock */
+        lock->lk_wchan = wchan_create(lock->lk_namebuf);
+        if (lock->lk_wchan == NULL) {
+                return ENOMEM;
+        }
+        /* initialize the spinlock that protects the lock */
+        spinlock_init(&lock->lk_lock);
+        /* lock is free to be acquired, with no owner threads */
+        lock->lk_value = false;
+        lock->lk_owner = NULL;
+        return 0;
+}
+
+static
+void
+lock_dtor(void *obj)
+{
+        struct lock *lock = obj;
+
+        spinlock_cleanup(&lock->lk_lock);
+        wchan_destroy(lock->lk_wchan);
+}
+
+void
+lock_bootstrap(void)
+{
+        lock_cache = kmem_cache_create("lock", sizeof(struct lock),
+                                       lock_ctor, lock_dtor);
+}
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
+        size_t len;
 
-        lock = kmalloc(sizeof(*lock));
+        lock = kmem_cache_alloc(lock_cache);
         if (lock == NULL) {
                 return NULL;
         }
 
-        lock->lk_name = kstrdup(name);
-        if (lock->lk_name == NULL) {
-                kfree(lock);
-                return NULL;
+        /* the wait channel shows as much of the name as fits */
+        len = strlen(name);
+        if (len >= sizeof(lock->lk_namebuf)) {
+                len = sizeof(lock->lk_namebuf) - 1;
+        }
+        memcpy(lock->lk_namebuf, name, len);
+        lock->lk_namebuf[len] = '\0';
+        if (name[len] != '\0') {
+                lock->lk_name = kstrdup(name);
+                if (lock->lk_name == NULL) {
+                        lock->lk_name = lock->lk_namebuf;
+                        kmem_cache_free(lock_cache, lock);
+                        return NULL;
+                }
         }
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
-        // add stuff here as needed
-        /* create lock and init as false (lock is free to be acquired) */
-        lock->lk_value = false;
-        /* no owner threads */
-        lock->lk_owner = NULL;
-        /* create wait channel (list of waiting threads) named as the lock */
-        lock->lk_wchan = wchan_create(lock->lk_name);
-        if (lock->lk_wchan == NULL) {
-                kfree(lock->lk_name);
-                kfree(lock);
-                return NULL;
-        }
-
-        /* initialize the spinlock that protects the lock */
-        spinlock_init(&lock->lk_lock);
+        KASSERT(lock->lk_value == false);
+        KASSERT(lock->lk_owner == NULL);
 
         return lock;
 }
@@ -180,12 +225,22 @@ lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
 
-        // add stuff here as needed
-        /* release the spinlock used to protect the lock */
-        spinlock_cleanup(&lock->lk_lock);
-        /* free elements allocated on the heap */
-        kfree(lock->lk_name);
-        kfree(lock);
+        /*
+         * Put the lock back the way lock_ctor made it: free, and
+         * with nobody waiting.
+         */
+        spinlock_acquire(&lock->lk_lock);
+        KASSERT(wchan_isempty(lock->lk_wchan, &lock->lk_lock));
+        lock->lk_value = false;
+        lock->lk_owner = NULL;
+        spinlock_release(&lock->lk_lock);
+
+        /* free the name if it did not fit in the lock */
+        if (lock->lk_name != lock->lk_namebuf) {
+                kfree(lock->lk_name);
+                lock->lk_name = lock->lk_namebuf;
+        }
+        kmem_cache_free(lock_cache, lock);
 }
 
 void 
@@ -235,9 +290,6 @@ lock_tryacquire(struct lock *lock)
 {
         int retval = 1;
 
-	/* Call this (atomically) before waiting for a lock */
-	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
-
         // Write this
         /* if you can acquire the spinlock (no one else is doing anything with this lock) */
         spinlock_acquire(&lock->lk_lock);
@@ -251,8 +303,15 @@ lock_tryacquire(struct lock *lock)
         /* release the spinlock */
         spinlock_release(&lock->lk_lock);
 
-	/* Call this (atomically) once the lock is acquired */
-	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	/*
+	 * We never waited, so only tell hangman about the lock once we
+	 * have it; failing to get a lock held by a thread that waits
+	 * for something of ours is not a deadlock.
+	 */
+	if (retval == 0) {
+		HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+		HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	}
 
         return retval;
 }
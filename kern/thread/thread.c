@@ -35,6 +35,8 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
@@ -50,11 +52,20 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <vm.h>
+#include <kmem_cache.h>
+#include "opt-dumbvm.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Time slice, in hardclocks, of a thread at priority level L. Lower
+ * levels get longer slices: 1, 1, 2, 2, 4, 4, 8, 8.
+ */
+#define SCHED_QUANTUM(l)	(1U << ((l) / 2))
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -69,6 +80,9 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Where thread structures come from. */
+static struct kmem_cache *thread_cache;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -120,14 +134,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -142,6 +156,10 @@ thread_create(const char *name)
 	thread->t_proc = NULL;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
+	/* Scheduler fields; thread_fork sets the real level */
+	thread->t_level = 0;
+	thread->t_ticks = 0;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
@@ -166,6 +184,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -179,9 +198,28 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_intr_user = false;
+
+	c->c_tlb_next = 0;
+	c->c_tlb_misses = 0;
+	c->c_tlb_evictions = 0;
+	c->c_asid = 0;
+	c->c_asid_next = 1;
+	c->c_asid_gen = 1;
+	c->c_asid_rollovers = 0;
+	c->c_shootdowns_sent = 0;
+	c->c_shootdowns_recv = 0;
+	c->c_shootdown_pages = 0;
+	c->c_shootdown_flushes = 0;
+	c->c_faultarounds = 0;
+	c->c_faultaround_pages = 0;
+	c->c_faultaround_mapped = 0;
+	c->c_faultaround_refaults = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
@@ -252,6 +290,24 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Number of cpus.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Get cpu number N.
+ */
+struct cpu *
+cpu_get(unsigned n)
+{
+	return cpuarray_get(&allcpus, n);
+}
+
 /*
  * Destroy a thread.
  *
@@ -284,7 +340,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -314,6 +370,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *rq;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -328,9 +387,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		rq = &curcpu->c_runqueue[i];
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -373,6 +435,9 @@ thread_bootstrap(void)
 {
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 NULL, NULL);
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -442,16 +507,130 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue handling.
+ *
+ * Each cpu has one run queue per priority level; a thread waits on
+ * the queue for its t_level. Threads are taken from the front of the
+ * highest-priority nonempty queue, and so round-robin within a level.
+ * All of these must be called with the cpu's run queue lock held.
+ */
+
+/*
+ * Highest-priority level with a thread waiting, or SCHED_NLEVELS if
+ * the cpu has nothing to run.
+ */
+static
+unsigned
+runqueue_toplevel(struct cpu *c)
+{
+	unsigned level;
+
+	for (level = 0; level < SCHED_NLEVELS; level++) {
+		if (!threadlist_isempty(&c->c_runqueue[level])) {
+			break;
+		}
+	}
+	return level;
+}
+
+/*
+ * Number of threads waiting to run on the cpu.
+ */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	unsigned level, count;
+
+	count = 0;
+	for (level = 0; level < SCHED_NLEVELS; level++) {
+		count += c->c_runqueue[level].tl_count;
+	}
+	return count;
+}
+
+/*
+ * Queue a thread on the cpu at its priority level.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_level < SCHED_NLEVELS);
+	threadlist_addtail(&c->c_runqueue[t->t_level], t);
+}
+
+/*
+ * Take the next thread to run, or NULL if there is none.
+ */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	unsigned level;
+
+	level = runqueue_toplevel(c);
+	if (level == SCHED_NLEVELS) {
+		return NULL;
+	}
+	return threadlist_remhead(&c->c_runqueue[level]);
+}
+
+/*
+ * Take the thread that would run last, or NULL if there is none. This
+ * is what migration gives away, which tends to move CPU-bound threads
+ * and leave interactive ones where they are.
+ */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	unsigned level;
+	struct thread *t;
+
+	for (level = SCHED_NLEVELS; level-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[level]);
+		if (t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Highest priority level a thread may run at. This comes from the
+ * nice value of its process: PRIO_MIN maps to level 0, PRIO_MAX to
+ * the lowest level, and the default of 0 to a level in between, so
+ * that setpriority can both favour and penalize a job class.
+ */
+static
+unsigned
+thread_toplevel(struct thread *t)
+{
+	int nice;
+
+	nice = (t->t_proc != NULL) ? t->t_proc->p_nice : 0;
+	return (unsigned)(nice - PRIO_MIN) * (SCHED_NLEVELS - 1) /
+		(PRIO_MAX - PRIO_MIN);
+}
+
 /*
  * Make a thread runnable.
  *
  * targetcpu might be curcpu; it might not be, too.
+ *
+ * A thread that is being woken up has been sleeping, most likely
+ * waiting for I/O, rather than using the cpu; move it up a level and
+ * give it a fresh time slice so that interactive threads get to run
+ * ahead of CPU-bound ones.
  */
 static
 void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
+	unsigned top;
 
 	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
@@ -464,9 +643,20 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
+	if (target->t_state == S_SLEEP) {
+		top = thread_toplevel(target);
+		if (target->t_level > top) {
+			target->t_level--;
+		}
+		if (target->t_level < top) {
+			target->t_level = top;
+		}
+		target->t_ticks = 0;
+	}
+
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -531,6 +721,9 @@ thread_fork(const char *name,
 		return result;
 	}
 
+	/* New threads start at the top level their process allows */
+	newthread->t_level = thread_toplevel(newthread);
+
 	/* Initialize active lock (holding it) */
 	lock_init(newthread->t_proc->p_lock_active, newthread);
 
@@ -590,8 +783,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. When
+	 * yielding, that includes the case where everything waiting
+	 * is of lower priority than we are: we'd only be picked again.
+	 */
+	if (newstate == S_READY &&
+	    runqueue_toplevel(curcpu) > cur->t_level) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -639,15 +837,25 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Before actually idling, give the VM system a chance to do
+	 * some background work (zeroing free pages). It does one small
+	 * piece at a time, so we check the runqueue again after each.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+#if OPT_DUMBVM
 			cpu_idle();
+#else
+			if (!vm_idle()) {
+				cpu_idle();
+			}
+#endif
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -821,17 +1029,110 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multilevel feedback queue. A thread starts at the top
+ * level its process's nice value allows (see thread_toplevel) and
+ * drops a level each time it uses up a whole time slice, so CPU-bound
+ * threads sink to the low levels, which get longer slices, while
+ * threads that sleep before their slice is up stay near the top and
+ * move back up a level each time they are woken. A thread is
+ * preempted at the next clock tick when one of higher priority is
+ * waiting on its cpu.
+ *
+ * Left alone, this would starve the low levels as long as there's
+ * enough interactive work, and would never let a thread that turned
+ * interactive climb back out of them quickly. So schedule(), called
+ * periodically from hardclock(), puts every thread on the current
+ * cpu back at its top level.
  */
 
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct threadlist boosted;
+	struct thread *t;
+	unsigned level;
+
+	threadlist_init(&boosted);
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (level = 0; level < SCHED_NLEVELS; level++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[level]))
+		       != NULL) {
+			threadlist_addtail(&boosted, t);
+		}
+	}
+	while ((t = threadlist_remhead(&boosted)) != NULL) {
+		t->t_level = thread_toplevel(t);
+		t->t_ticks = 0;
+		runqueue_add(curcpu, t);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	threadlist_cleanup(&boosted);
+
+	/* If we interrupted the idle loop, curthread isn't running. */
+	if (!curcpu->c_isidle) {
+		curthread->t_level = thread_toplevel(curthread);
+		curthread->t_ticks = 0;
+	}
+}
+
+/*
+ * Charge a clock tick to the current thread. Called from hardclock().
+ *
+ * Returns true if the thread should yield: when it has used up its
+ * time slice, in which case it also drops a level, or when a thread
+ * of higher priority is waiting.
+ */
+bool
+thread_charge_tick(void)
+{
+	struct thread *cur;
+	unsigned top, waiting;
+
+	/* If we interrupted the idle loop, there's nothing to charge. */
+	if (curcpu->c_isidle) {
+		return false;
+	}
+
+	cur = curthread;
+
+	/* The process may have been reniced to below our level. */
+	top = thread_toplevel(cur);
+	if (cur->t_level < top) {
+		cur->t_level = top;
+	}
+
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_level)) {
+		cur->t_ticks = 0;
+		if (cur->t_level < SCHED_NLEVELS - 1) {
+			cur->t_level++;
+		}
+		return true;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	waiting = runqueue_toplevel(curcpu);
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	return waiting < cur->t_level;
+}
+
+/*
+ * Move the current thread to the top level its process allows, with
+ * a fresh time slice. Other threads of the process get there at their
+ * next wakeup or priority boost.
+ */
+void
+thread_reprioritize(void)
+{
+	int spl;
+
+	spl = splhigh();
+	curthread->t_level = thread_toplevel(curthread);
+	curthread->t_ticks = 0;
+	splx(spl);
 }
 
 /*
@@ -865,9 +1166,9 @@ thread_consider_migration(void)
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += runqueue_count(c);
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = runqueue_count(c);
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -881,7 +1182,7 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runqueue_remtail(curcpu);
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -892,7 +1193,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (runqueue_count(c) < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -923,7 +1224,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -947,7 +1248,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
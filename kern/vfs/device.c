@@ -42,6 +42,7 @@
 #include <synch.h>
 #include <vnode.h>
 #include <device.h>
+#include <kmem_cache.h>
 
 /*
  * Called for each open().
@@ -350,6 +351,19 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_lookparent = vopfail_lookparent_notdir,
 };
 
+/* Where device vnodes come from. */
+static struct kmem_cache *dev_vnode_cache;
+
+/*
+ * Set up the device vnode cache.
+ */
+void
+devvnode_bootstrap(void)
+{
+	dev_vnode_cache = kmem_cache_create("vnode", sizeof(struct vnode),
+					    NULL, NULL);
+}
+
 /*
  * Function to create a vnode for a VFS device.
  */
@@ -359,7 +373,7 @@ dev_create_vnode(struct device *dev)
 	int result;
 	struct vnode *v;
 
-	v = kmalloc(sizeof(struct vnode));
+	v = kmem_cache_alloc(dev_vnode_cache);
 	if (v==NULL) {
 		return NULL;
 	}
@@ -384,5 +398,5 @@ dev_uncreate_vnode(struct vnode *vn)
 {
 	KASSERT(vn->vn_ops == &dev_vnode_ops);
 	vnode_cleanup(vn);
-	kfree(vn);
+	kmem_cache_free(dev_vnode_cache, vn);
 }
@@ -112,6 +112,7 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	devvnode_bootstrap();
 	devnull_create();
 	semfs_bootstrap();
 }
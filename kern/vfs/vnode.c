@@ -36,6 +36,7 @@
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <addrspace.h>
 
 /*
  * Initialize an abstract vnode.
@@ -52,6 +53,8 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+	vn->vn_pagecache = NULL;
+	vn->vn_gen = 0;
 	return 0;
 }
 
@@ -62,6 +65,11 @@ void
 vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
+	/* a page cache holds a reference */
+	KASSERT(vn->vn_pagecache == NULL);
+
+	/* the exec cache must not match a new vnode at this address */
+	load_elf_forget(vn);
 
 	spinlock_cleanup(&vn->vn_countlock);
 
@@ -86,6 +94,65 @@ vnode_incref(struct vnode *vn)
 	spinlock_release(&vn->vn_countlock);
 }
 
+/*
+ * Bump the generation number.
+ * Called by vnode_write and vnode_truncate.
+ */
+void
+vnode_modified(struct vnode *vn)
+{
+	KASSERT(vn != NULL);
+
+	spinlock_acquire(&vn->vn_countlock);
+	vn->vn_gen++;
+	spinlock_release(&vn->vn_countlock);
+}
+
+/*
+ * Get the generation number.
+ */
+unsigned
+vnode_getgen(struct vnode *vn)
+{
+	unsigned gen;
+
+	KASSERT(vn != NULL);
+
+	spinlock_acquire(&vn->vn_countlock);
+	gen = vn->vn_gen;
+	spinlock_release(&vn->vn_countlock);
+
+	return gen;
+}
+
+/*
+ * Write to the file, then bump the generation number, even if the
+ * write failed part way. Called by VOP_WRITE.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	int result;
+
+	result = __VOP(vn, write)(vn, uio);
+	vnode_modified(vn);
+	return result;
+}
+
+/*
+ * Truncate the file, then bump the generation number.
+ * Called by VOP_TRUNCATE.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t pos)
+{
+	int result;
+
+	result = __VOP(vn, truncate)(vn, pos);
+	vnode_modified(vn);
+	return result;
+}
+
 /*
  * Decrement refcount.
  * Called by VOP_DECREF.
@@ -29,49 +29,312 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
+#include <vnode.h>
 #include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <swap.h>
 #include <vm.h>
 #include <proc.h>
+#include <current.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
  * assignment, this file is not compiled or linked or in any way
  * used. The cheesy hack versions in dumbvm.c are used instead.
+ *
+ * An address space is a list of regions (see addrspace.h) plus a
+ * page table. Defining regions never allocates physical memory;
+ * pages are allocated and filled in by vm_fault on first touch.
  */
 
+/*
+ * Allocate a region covering NPAGES pages starting at VBASE.
+ */
+static
+struct region *
+region_create(vaddr_t vbase, size_t npages, unsigned perm)
+{
+	struct region *rg;
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return NULL;
+	}
+
+	rg->rg_vbase = vbase;
+	rg->rg_npages = npages;
+	rg->rg_perm = perm;
+	rg->rg_vnode = NULL;
+	rg->rg_offset = 0;
+	rg->rg_vaddr = vbase;
+	rg->rg_filesize = 0;
+	rg->rg_mmap = false;
+	rg->rg_cache = NULL;
+	rg->rg_cachenext = NULL;
+	rg->rg_as = NULL;
+	rg->rg_shared = false;
+	rg->rg_advice = MADV_NORMAL;
+	rg->rg_next = NULL;
+
+	return rg;
+}
+
+/*
+ * Release NPAGES pages starting at VBASE, whether resident or paged
+ * out. The caller takes care of the TLB.
+ */
+static
+void
+as_freepages(struct addrspace *as, vaddr_t vbase, size_t npages)
+{
+	vaddr_t va;
+	pte_t *pte;
+	paddr_t paddr;
+	size_t i;
+
+	for (i = 0; i < npages; i++) {
+		va = vbase + i * PAGE_SIZE;
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			continue;
+		}
+		/* Pinning waits out a pageout in progress. */
+		paddr = pt_pin(pte);
+		if (paddr != 0) {
+			if (*pte & PTE_LOCKED) {
+				as->as_nlocked--;
+			}
+			*pte = 0;
+			vm_free_upage(paddr);
+			as_rss_adjust(as, -1);
+		}
+		else if (*pte & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(*pte));
+			*pte = 0;
+		}
+	}
+}
+
+/*
+ * Release the pages of a region and the region itself.
+ */
+static
+void
+region_destroy(struct addrspace *as, struct region *rg)
+{
+	/* Before the pages go, so the cache stops looking at them. */
+	if (rg->rg_cache != NULL) {
+		pagecache_delmapper(rg->rg_cache, rg);
+	}
+	as_freepages(as, rg->rg_vbase, rg->rg_npages);
+
+	if (rg->rg_vnode != NULL) {
+		VOP_DECREF(rg->rg_vnode);
+	}
+	if (rg->rg_cache != NULL) {
+		pagecache_release(rg->rg_cache);
+	}
+	kfree(rg);
+}
+
+/*
+ * Add a region at the head of the region list, and to the mappers of
+ * its page cache if it has one.
+ */
+static
+void
+region_add(struct addrspace *as, struct region *rg)
+{
+	rg->rg_as = as;
+	rg->rg_next = as->as_regions;
+	as->as_regions = rg;
+	if (rg->rg_cache != NULL) {
+		pagecache_addmapper(rg->rg_cache, rg);
+	}
+}
+
+/*
+ * Take a region off the region list.
+ */
+static
+void
+region_remove(struct addrspace *as, struct region *rg)
+{
+	struct region **p;
+
+	for (p = &as->as_regions; *p != rg; p = &(*p)->rg_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = rg->rg_next;
+	rg->rg_next = NULL;
+}
+
+/*
+ * Check whether [VBASE, VBASE+NPAGES pages) overlaps any region.
+ */
+static
+bool
+as_overlaps(struct addrspace *as, vaddr_t vbase, size_t npages)
+{
+	struct region *rg;
+	vaddr_t end;
+
+	end = vbase + npages * PAGE_SIZE;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_vbase < end &&
+		    vbase < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return true;
+		}
+	}
+	return false;
+}
+
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as;
+	unsigned i;
 
 	as = kmalloc(sizeof(struct addrspace));
 	if (as == NULL) {
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_regions = NULL;
+	as->as_stack = NULL;
+	as->as_heap = NULL;
+	as->as_heapbreak = 0;
+	for (i = 0; i < MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+		as->as_asidgen[i] = 0;
+	}
+	as->as_lastcpu = 0;
+	as->as_rss = 0;
+	spinlock_init(&as->as_rsslock);
+	as->as_nlocked = 0;
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		spinlock_cleanup(&as->as_rsslock);
+		kfree(as);
+		return NULL;
+	}
 
 	return as;
 }
 
+/*
+ * Copy an address space: duplicate the region list and share every
+ * resident page copy-on-write. Each page gets one more reference in
+ * the coremap, and since a shared page is only ever mapped read-only,
+ * whichever side writes to it first takes a private copy in vm_fault.
+ * Pages that were never touched stay untouched in the copy as well.
+ * Pages that are paged out are read into a private page for the copy.
+ */
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct region *oldrg, *newrg;
+	pte_t *oldpte, *newpte;
+	paddr_t paddr;
+	vaddr_t va;
+	size_t i;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	for (oldrg = old->as_regions; oldrg != NULL; oldrg = oldrg->rg_next) {
+		newrg = region_create(oldrg->rg_vbase, oldrg->rg_npages,
+				      oldrg->rg_perm);
+		if (newrg == NULL) {
+			as_destroy(newas);
+			return ENOMEM;
+		}
+		newrg->rg_vnode = oldrg->rg_vnode;
+		if (newrg->rg_vnode != NULL) {
+			VOP_INCREF(newrg->rg_vnode);
+		}
+		newrg->rg_offset = oldrg->rg_offset;
+		newrg->rg_vaddr = oldrg->rg_vaddr;
+		newrg->rg_filesize = oldrg->rg_filesize;
+		newrg->rg_mmap = oldrg->rg_mmap;
+		newrg->rg_cache = oldrg->rg_cache;
+		if (newrg->rg_cache != NULL) {
+			pagecache_incref(newrg->rg_cache);
+		}
+		newrg->rg_shared = oldrg->rg_shared;
+		newrg->rg_advice = oldrg->rg_advice;
+		region_add(newas, newrg);
+		if (oldrg == old->as_stack) {
+			newas->as_stack = newrg;
+		}
+		if (oldrg == old->as_heap) {
+			newas->as_heap = newrg;
+			newas->as_heapbreak = old->as_heapbreak;
+		}
+
+		for (i = 0; i < oldrg->rg_npages; i++) {
+			va = oldrg->rg_vbase + i * PAGE_SIZE;
+			oldpte = pt_lookup(old->as_pt, va, false);
+			if (oldpte == NULL ||
+			    (*oldpte & (PTE_VALID | PTE_SWAPPED)) == 0) {
+				continue;
+			}
+
+			newpte = pt_lookup(newas->as_pt, va, true);
+			if (newpte == NULL) {
+				as_destroy(newas);
+				return ENOMEM;
+			}
+
+			paddr = pt_pin(oldpte);
+			if (paddr != 0) {
+				/* Resident: share it. Nobody owns it now. */
+				coremap_incref(paddr);
+				coremap_setowner(paddr, NULL, 0);
+				*oldpte &= ~(pte_t)PTE_TLBDIRTY;
+				*newpte = paddr | PTE_VALID;
+				coremap_unpin(paddr);
+				as_rss_adjust(newas, 1);
+				continue;
+			}
+
+			/* Paged out: give the copy its own page. */
+			KASSERT(*oldpte & PTE_SWAPPED);
+			paddr = vm_alloc_upage();
+			if (paddr == 0) {
+				as_destroy(newas);
+				return ENOMEM;
+			}
+			result = swap_read(PTE_SLOT(*oldpte), paddr);
+			if (result) {
+				vm_free_upage(paddr);
+				as_destroy(newas);
+				return result;
+			}
+			coremap_setowner(paddr, newas, va);
+			*newpte = paddr | PTE_VALID;
+			coremap_unpin(paddr);
+			as_rss_adjust(newas, 1);
+			curproc->p_usage.pu_cowcopies++;
+		}
+	}
+
 	/*
-	 * Write this.
+	 * The parent may still hold writable TLB entries for the
+	 * pages that are now shared; drop them so its next write
+	 * faults and gets a private copy. (Only this cpu can have
+	 * any: entries left on other cpus carry ASIDs the parent
+	 * will not be given again.)
 	 */
-
-	(void)old;
+	vm_tlb_flush_as(old);
 
 	*ret = newas;
 	return 0;
@@ -80,10 +343,19 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct region *rg;
+
+	/* Its frames are about to be reused; purge its entries. */
+	vm_tlb_flush_as(as);
+
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		region_destroy(as, rg);
+	}
 
+	pt_destroy(as->as_pt);
+	spinlock_cleanup(&as->as_rsslock);
 	kfree(as);
 }
 
@@ -96,24 +368,27 @@ as_activate(void)
 	if (as == NULL) {
 		/*
 		 * Kernel thread without an address space; leave the
-		 * prior address space in place.
+		 * prior address space's TLB entries in place, but not
+		 * its page table, which may be destroyed while we run.
 		 */
+		vm_tlb_deactivate();
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	/* TLB entries are tagged with ASIDs; no flush needed. */
+	vm_tlb_activate(as);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * as_destroy purges the address space's TLB entries itself,
+	 * and entries of a live address space are harmless while
+	 * another ASID is current; but the fast refill path must stop
+	 * looking at its page table.
 	 */
+	vm_tlb_deactivate();
 }
 
 /*
@@ -122,57 +397,430 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Only
+ * write permission is enforced, since the MIPS TLB cannot express
+ * the other two.
+ *
+ * No memory is allocated here; the region starts out zero-filled
+ * on demand until as_define_backing attaches file data to it.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	unsigned perm = 0;
+	size_t npages;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = memsize / PAGE_SIZE;
+
+	if (vaddr + memsize > USERSPACETOP || vaddr + memsize < vaddr) {
+		return EFAULT;
+	}
+
+	if (readable) {
+		perm |= REGION_READ;
+	}
+	if (writeable) {
+		perm |= REGION_WRITE;
+	}
+	if (executable) {
+		perm |= REGION_EXEC;
+	}
+
+	rg = region_create(vaddr, npages, perm);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	region_add(as, rg);
+
+	return 0;
+}
+
+/*
+ * Record that the region containing VADDR takes FILESIZE bytes of
+ * its initial contents from V, starting at file offset OFFSET. The
+ * region keeps a reference to the vnode, so the caller may close its
+ * own.
+ *
+ * A read-only region whose pages line up with pages of the file, and
+ * that has file data in every page, is mapped from the vnode's page
+ * cache instead, so that all processes running the same program share
+ * one resident copy of its text. As on other systems, the parts of
+ * the first and last page outside the segment then show whatever
+ * surrounds it in the file rather than zeros. If the program has been
+ * rewritten since its pages were cached, attaching rereads them.
+ */
+int
+as_define_backing(struct addrspace *as, struct vnode *v,
+		  off_t offset, vaddr_t vaddr, size_t filesize)
+{
+	struct region *rg;
+	struct pagecache *pc;
+	off_t base;
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL) {
+		return EFAULT;
+	}
+
+	if (filesize > rg->rg_vbase + rg->rg_npages * PAGE_SIZE - vaddr) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = rg->rg_vbase + rg->rg_npages * PAGE_SIZE - vaddr;
+	}
+
+	base = offset - (off_t)(vaddr - rg->rg_vbase);
+	if ((rg->rg_perm & REGION_WRITE) == 0 && rg->rg_cache == NULL &&
+	    base >= 0 && base % PAGE_SIZE == 0 &&
+	    vaddr + filesize > rg->rg_vbase + (rg->rg_npages - 1) * PAGE_SIZE &&
+	    pagecache_attach(v, &pc) == 0) {
+		rg->rg_cache = pc;
+		rg->rg_offset = base;
+		pagecache_addmapper(pc, rg);
+		return 0;
+	}
+
+	VOP_INCREF(v);
+	if (rg->rg_vnode != NULL) {
+		VOP_DECREF(rg->rg_vnode);
+	}
+	rg->rg_vnode = v;
+	rg->rg_offset = offset;
+	rg->rg_vaddr = vaddr;
+	rg->rg_filesize = filesize;
+
+	return 0;
+}
+
+/*
+ * Find the region containing VADDR.
+ */
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+
+	return NULL;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * Nothing to do: pages are allocated on first touch.
 	 */
 
 	(void)as;
 	return 0;
 }
 
+/*
+ * Now that all the segments are defined, put the (empty) heap right
+ * above the highest one.
+ */
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	vaddr_t top, end;
+
+	KASSERT(as->as_heap == NULL);
+
+	top = 0;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (end > top) {
+			top = end;
+		}
+	}
+
+	rg = region_create(top, 0, REGION_READ | REGION_WRITE);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	region_add(as, rg);
+	as->as_heap = rg;
+	as->as_heapbreak = top;
+
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t *vaddr, size_t npages, unsigned perm,
+	struct pagecache *pc, off_t offset, bool shared)
+{
+	struct region *rg;
+	vaddr_t top, base, limit;
+
+	KASSERT(npages > 0);
+	KASSERT((offset & ~(off_t)PAGE_FRAME) == 0);
+
+	if (npages > USERSPACETOP / PAGE_SIZE) {
+		return ENOMEM;
+	}
+
+	if (*vaddr != 0) {
+		base = *vaddr;
+		if ((base & PAGE_FRAME) != base ||
+		    base + npages * PAGE_SIZE > USERSPACETOP ||
+		    base + npages * PAGE_SIZE < base ||
+		    as_overlaps(as, base, npages)) {
+			return EINVAL;
+		}
+	}
+	else {
+		/*
+		 * Search down from just below the lowest the stack may
+		 * grow to, stopping at the top of the heap.
+		 */
+		top = USERSTACK - (VM_STACKMAXPAGES + VM_STACKGUARDPAGES)
+			* PAGE_SIZE;
+		limit = 0;
+		if (as->as_heap != NULL) {
+			limit = as->as_heap->rg_vbase +
+				as->as_heap->rg_npages * PAGE_SIZE;
+		}
+		while (1) {
+			if (top < limit + npages * PAGE_SIZE) {
+				return ENOMEM;
+			}
+			base = top - npages * PAGE_SIZE;
+			for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+				if (rg->rg_vbase < top &&
+				    base < rg->rg_vbase +
+				    rg->rg_npages * PAGE_SIZE) {
+					break;
+				}
+			}
+			if (rg == NULL) {
+				break;
+			}
+			/* skip below the region in the way */
+			top = rg->rg_vbase;
+		}
+	}
+
+	rg = region_create(base, npages, perm);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_mmap = true;
+	rg->rg_cache = pc;
+	rg->rg_offset = offset;
+	rg->rg_shared = shared;
+	region_add(as, rg);
+
+	*vaddr = base;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	struct region *rg, *next, *tail;
+	vaddr_t end, rgend, start, stop, va;
+
+	/* the TLB work below assumes AS is the one loaded */
+	KASSERT(as == proc_getas());
+
+	if ((vaddr & PAGE_FRAME) != vaddr || npages == 0 ||
+	    npages > (USERSPACETOP - vaddr) / PAGE_SIZE) {
+		return EINVAL;
+	}
+	end = vaddr + npages * PAGE_SIZE;
+
+	/* Only mmap regions may be unmapped. */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (!rg->rg_mmap && rg->rg_vbase < end &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return EINVAL;
+		}
+	}
+
+	for (rg = as->as_regions; rg != NULL; rg = next) {
+		next = rg->rg_next;
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (rgend <= vaddr || end <= rg->rg_vbase) {
+			continue;
+		}
+
+		start = vaddr > rg->rg_vbase ? vaddr : rg->rg_vbase;
+		stop = end < rgend ? end : rgend;
+
+		if (stop < rgend && start > rg->rg_vbase) {
+			/* Hole in the middle: the part above is new. */
+			tail = region_create(stop, (rgend - stop) / PAGE_SIZE,
+					     rg->rg_perm);
+			if (tail == NULL) {
+				return ENOMEM;
+			}
+			tail->rg_mmap = true;
+			tail->rg_cache = rg->rg_cache;
+			if (tail->rg_cache != NULL) {
+				pagecache_incref(tail->rg_cache);
+			}
+			tail->rg_offset = rg->rg_offset + (stop - rg->rg_vbase);
+			tail->rg_shared = rg->rg_shared;
+			tail->rg_advice = rg->rg_advice;
+			region_add(as, tail);
+		}
+
+		for (va = start; va < stop; va += PAGE_SIZE) {
+			vm_tlb_invalidate(va);
+		}
+		as_freepages(as, start, (stop - start) / PAGE_SIZE);
+
+		if (start == rg->rg_vbase && stop == rgend) {
+			region_remove(as, rg);
+			region_destroy(as, rg);
+		}
+		else if (start == rg->rg_vbase) {
+			rg->rg_offset += stop - rg->rg_vbase;
+			rg->rg_npages -= (stop - rg->rg_vbase) / PAGE_SIZE;
+			rg->rg_vbase = stop;
+		}
+		else {
+			rg->rg_npages = (start - rg->rg_vbase) / PAGE_SIZE;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Top of the highest region below the stack, or 0 if there is none.
+ */
+static
+vaddr_t
+as_below_stack(struct addrspace *as)
+{
+	struct region *rg;
+	vaddr_t end, top;
+
+	top = 0;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (rg != as->as_stack && end <= as->as_stack->rg_vbase &&
+		    end > top) {
+			top = end;
+		}
+	}
+	return top;
+}
+
+struct region *
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack;
+	vaddr_t newbase;
+
+	stack = as->as_stack;
+	if (stack == NULL) {
+		return NULL;
+	}
+
+	newbase = vaddr & PAGE_FRAME;
+	if (newbase >= stack->rg_vbase ||
+	    newbase < USERSTACK - VM_STACKMAXPAGES * PAGE_SIZE) {
+		return NULL;
+	}
+	if (newbase < as_below_stack(as) + VM_STACKGUARDPAGES * PAGE_SIZE) {
+		/* in the guard gap */
+		return NULL;
+	}
+
+	stack->rg_npages += (stack->rg_vbase - newbase) / PAGE_SIZE;
+	stack->rg_vbase = newbase;
+
+	return stack;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *heap, *rg;
+	vaddr_t newbreak, oldtop, newtop, va;
+
+	/* the TLB work below assumes AS is the one loaded */
+	KASSERT(as == proc_getas());
+
+	heap = as->as_heap;
+	if (heap == NULL) {
+		return ENOMEM;
+	}
+
+	if (amount < 0 &&
+	    (vaddr_t)-amount > as->as_heapbreak - heap->rg_vbase) {
+		return EINVAL;
+	}
+	if (amount > 0 &&
+	    (vaddr_t)amount > USERSPACETOP - as->as_heapbreak) {
+		return ENOMEM;
+	}
+
+	newbreak = as->as_heapbreak + amount;
+	oldtop = heap->rg_vbase + heap->rg_npages * PAGE_SIZE;
+	newtop = ROUNDUP(newbreak, PAGE_SIZE);
+
+	if (newtop > oldtop) {
+		/* Growing: make sure we do not run into anything. */
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			if (rg != heap && rg->rg_vbase < newtop &&
+			    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > oldtop) {
+				return ENOMEM;
+			}
+		}
+		/* ...including the stack's guard gap. */
+		if (as->as_stack != NULL && as->as_stack->rg_vbase >= oldtop &&
+		    newtop + VM_STACKGUARDPAGES * PAGE_SIZE >
+		    as->as_stack->rg_vbase) {
+			return ENOMEM;
+		}
+	}
+	else if (newtop < oldtop) {
+		/* Shrinking: give the pages back now. */
+		for (va = newtop; va < oldtop; va += PAGE_SIZE) {
+			vm_tlb_invalidate(va);
+		}
+		as_freepages(as, newtop, (oldtop - newtop) / PAGE_SIZE);
+	}
+
+	heap->rg_npages = (newtop - heap->rg_vbase) / PAGE_SIZE;
+	*oldbreak = as->as_heapbreak;
+	as->as_heapbreak = newbreak;
 
-	(void)as;
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
 
-	(void)as;
+	KASSERT(as->as_stack == NULL);
+
+	/* One page to start with; vm_fault grows it as needed. */
+	rg = region_create(USERSTACK - PAGE_SIZE, 1,
+			   REGION_READ | REGION_WRITE);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	region_add(as, rg);
+	as->as_stack = rg;
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +828,172 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Check that every page of the NPAGES pages from VADDR is in some
+ * region. (The range itself has been checked against USERSPACETOP.)
+ */
+static
+bool
+as_range_mapped(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	struct region *rg;
+	vaddr_t va, end;
+
+	end = vaddr + npages * PAGE_SIZE;
+	va = vaddr;
+	while (va < end) {
+		rg = as_find_region(as, va);
+		if (rg == NULL) {
+			return false;
+		}
+		va = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	}
+	return true;
+}
+
+int
+as_madvise(struct addrspace *as, vaddr_t vaddr, size_t npages, int advice)
+{
+	struct region *rg;
+	vaddr_t va, end, rgend, start, stop;
+	pte_t *pte;
+
+	/* the TLB work below assumes AS is the one loaded */
+	KASSERT(as == proc_getas());
+
+	if (!as_range_mapped(as, vaddr, npages)) {
+		return ENOMEM;
+	}
+	end = vaddr + npages * PAGE_SIZE;
+
+	switch (advice) {
+	    case MADV_NORMAL:
+	    case MADV_RANDOM:
+	    case MADV_SEQUENTIAL:
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+			if (rg->rg_vbase < end && vaddr < rgend) {
+				rg->rg_advice = advice;
+			}
+		}
+		return 0;
+
+	    case MADV_WILLNEED:
+		/* Only a hint: stop quietly when memory runs short. */
+		for (va = vaddr; va < end; va += PAGE_SIZE) {
+			if (vm_prefault(as, va, false)) {
+				break;
+			}
+		}
+		return 0;
+
+	    case MADV_DONTNEED:
+		for (va = vaddr; va < end; va += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL && (*pte & PTE_LOCKED)) {
+				return EINVAL;
+			}
+		}
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+			if (rgend <= vaddr || end <= rg->rg_vbase) {
+				continue;
+			}
+			start = vaddr > rg->rg_vbase ? vaddr : rg->rg_vbase;
+			stop = end < rgend ? end : rgend;
+			for (va = start; va < stop; va += PAGE_SIZE) {
+				vm_tlb_invalidate(va);
+			}
+			/* dirty shared pages stay in (and go to) the page cache */
+			as_freepages(as, start, (stop - start) / PAGE_SIZE);
+		}
+		return 0;
+	}
+
+	return EINVAL;
+}
+
+int
+as_mincore(struct addrspace *as, vaddr_t vaddr, size_t npages,
+	   unsigned char *vec)
+{
+	pte_t *pte;
+	size_t i;
+
+	if (!as_range_mapped(as, vaddr, npages)) {
+		return ENOMEM;
+	}
+
+	/* A snapshot; the pageout code may change it any time. */
+	for (i = 0; i < npages; i++) {
+		pte = pt_lookup(as->as_pt, vaddr + i * PAGE_SIZE, false);
+		vec[i] = (pte != NULL && (*pte & PTE_VALID)) ? 1 : 0;
+	}
+	return 0;
+}
+
+int
+as_mlock(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	size_t i;
+	int result;
+
+	if (!as_range_mapped(as, vaddr, npages)) {
+		return ENOMEM;
+	}
+	if (npages > coremap_totalpages() / VM_MLOCKFRACTION ||
+	    as->as_nlocked > coremap_totalpages() / VM_MLOCKFRACTION - npages) {
+		return EAGAIN;
+	}
+
+	/* Pages already locked count again above; close enough. */
+	for (i = 0; i < npages; i++) {
+		result = vm_prefault(as, vaddr + i * PAGE_SIZE, true);
+		if (result) {
+			/* what is locked stays locked, as elsewhere */
+			return result == EFAULT ? ENOMEM : result;
+		}
+	}
+	return 0;
+}
+
+int
+as_munlock(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	pte_t *pte;
+	paddr_t paddr;
+	vaddr_t va;
+	size_t i;
+
+	if (!as_range_mapped(as, vaddr, npages)) {
+		return ENOMEM;
+	}
+
+	for (i = 0; i < npages; i++) {
+		va = vaddr + i * PAGE_SIZE;
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || (*pte & PTE_LOCKED) == 0) {
+			continue;
+		}
+		/* Locked pages are resident, and only we change the bit. */
+		paddr = pt_pin(pte);
+		KASSERT(paddr != 0);
+		*pte &= ~(pte_t)PTE_LOCKED;
+		as->as_nlocked--;
+		/* Give it back to the clock if it is ours alone. */
+		if (coremap_refcount(paddr) == 1) {
+			coremap_setowner(paddr, as, va);
+		}
+		coremap_unpin(paddr);
+	}
+	return 0;
+}
+
+void
+as_rss_adjust(struct addrspace *as, int delta)
+{
+	spinlock_acquire(&as->as_rsslock);
+	KASSERT(delta >= 0 || as->as_rss >= (unsigned)-delta);
+	as->as_rss += delta;
+	spinlock_release(&as->as_rsslock);
+}
@@ -142,12 +142,67 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Block copy used by copyin and copyout. memcpy only copies by words
+ * when the length is a multiple of the word size as well, which most
+ * buffers handed to read and write are not. Here, whenever the two
+ * pointers are aligned the same way, copy bytes up to a word
+ * boundary, then four words per iteration, then the remaining words
+ * and bytes. Otherwise there is nothing better than copying bytes,
+ * which memcpy does.
+ *
+ * Like memcpy this is only safe on user addresses when protected by
+ * the tm_badfaultfunc/copyfail logic.
+ */
+static
+void
+copyblock(void *dest, const void *src, size_t len)
+{
+	char *d = dest;
+	const char *s = src;
+	uint32_t *dw;
+	const uint32_t *sw;
+
+	if (((uintptr_t)d ^ (uintptr_t)s) % sizeof(uint32_t) != 0) {
+		memcpy(dest, src, len);
+		return;
+	}
+
+	while (len > 0 && (uintptr_t)d % sizeof(uint32_t) != 0) {
+		*d++ = *s++;
+		len--;
+	}
+
+	dw = (uint32_t *)d;
+	sw = (const uint32_t *)s;
+	while (len >= 4 * sizeof(uint32_t)) {
+		dw[0] = sw[0];
+		dw[1] = sw[1];
+		dw[2] = sw[2];
+		dw[3] = sw[3];
+		dw += 4;
+		sw += 4;
+		len -= 4 * sizeof(uint32_t);
+	}
+	while (len >= sizeof(uint32_t)) {
+		*dw++ = *sw++;
+		len -= sizeof(uint32_t);
+	}
+
+	d = (char *)dw;
+	s = (const char *)sw;
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+}
+
 /*
  * copyin
  *
  * Copy a block of memory of length LEN from user-level address USERSRC
- * to kernel address DEST. We can use memcpy because it's protected by
- * the tm_badfaultfunc/copyfail logic.
+ * to kernel address DEST. We can use copyblock because it's protected
+ * by the tm_badfaultfunc/copyfail logic.
  */
 int
 copyin(const_userptr_t usersrc, void *dest, size_t len)
@@ -172,7 +227,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copyblock(dest, (const void *)usersrc, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -182,7 +237,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
  * copyout
  *
  * Copy a block of memory of length LEN from kernel address SRC to
- * user-level address USERDEST. We can use memcpy because it's
+ * user-level address USERDEST. We can use copyblock because it's
  * protected by the tm_badfaultfunc/copyfail logic.
  */
 int
@@ -208,7 +263,7 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copyblock((void *)userdest, src, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -0,0 +1,916 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Coremap physical page allocator. See coremap.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vm.h>
+
+/* "null" page number for the free list links */
+#define CM_NONE ((unsigned)-1)
+
+/* Largest buddy block: 2^COREMAP_MAXORDER pages */
+#define COREMAP_MAXORDER 10
+#define COREMAP_NORDERS (COREMAP_MAXORDER + 1)
+
+/* Idle cpus keep up to 1/COREMAP_ZERO_FRACTION of memory pre-zeroed */
+#define COREMAP_ZERO_FRACTION 16
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+static struct coremap_entry *coremap;	/* one entry per page of RAM */
+static unsigned coremap_npages;		/* number of entries */
+static unsigned coremap_nfree;		/* free pages, zeroed or not */
+static unsigned coremap_nmanaged;	/* pages not fixed */
+
+/* Buddy free lists, by order */
+static unsigned freelists[COREMAP_NORDERS];
+static unsigned coremap_nblocks[COREMAP_NORDERS];
+static unsigned coremap_splits;		/* blocks split in two */
+static unsigned coremap_merges;		/* buddies merged */
+static unsigned coremap_allocfails;	/* multi-page allocations refused */
+
+/* Pre-zeroed page pool */
+static unsigned zerolist_head = CM_NONE;
+static unsigned coremap_nzero;		/* pages on the zero list */
+static unsigned coremap_zerotarget;	/* stop zeroing at this many */
+static unsigned coremap_zerohits;	/* zeroed allocations from the pool */
+static unsigned coremap_zeromisses;	/* ...that had to zero synchronously */
+static unsigned coremap_idlezeroed;	/* pages zeroed by idle cpus */
+
+static struct wchan *coremap_wchan;	/* waiting for a pinned page */
+static struct wchan *pageout_wchan;	/* the pageout thread */
+static unsigned coremap_lowwater;	/* wake pageout below this */
+static unsigned clock_hand;		/* next page for the clock to look at */
+
+/*
+ * Reset the user-page fields of a coremap entry.
+ */
+static
+void
+cme_clear(struct coremap_entry *cme)
+{
+	cme->cme_as = NULL;
+	cme->cme_vaddr = 0;
+	cme->cme_swapslot = SWAP_NOSLOT;
+	cme->cme_busy = false;
+	cme->cme_referenced = false;
+	cme->cme_dirty = false;
+	cme->cme_cache = NULL;
+	cme->cme_cacheidx = 0;
+}
+
+/*
+ * List manipulation, for the buddy lists and the zero list. Must hold
+ * coremap_lock (or be in single-threaded bootstrap), as must all the
+ * free page handling below.
+ */
+static
+void
+list_push(unsigned *head, unsigned page)
+{
+	coremap[page].cme_prev = CM_NONE;
+	coremap[page].cme_next = *head;
+	if (*head != CM_NONE) {
+		coremap[*head].cme_prev = page;
+	}
+	*head = page;
+}
+
+static
+void
+list_remove(unsigned *head, unsigned page)
+{
+	struct coremap_entry *cme = &coremap[page];
+
+	if (cme->cme_prev != CM_NONE) {
+		coremap[cme->cme_prev].cme_next = cme->cme_next;
+	}
+	else {
+		*head = cme->cme_next;
+	}
+	if (cme->cme_next != CM_NONE) {
+		coremap[cme->cme_next].cme_prev = cme->cme_prev;
+	}
+	cme->cme_prev = cme->cme_next = CM_NONE;
+}
+
+/*
+ * Buddy blocks. A free block of 2^ORDER pages starts at a page number
+ * that is a multiple of 2^ORDER; its first page has cme_npages set to
+ * the size of the block and is on freelists[ORDER]. All its pages are
+ * CME_FREE, and the others have cme_npages 0.
+ */
+static
+void
+block_push(unsigned page, unsigned order)
+{
+	coremap[page].cme_npages = 1U << order;
+	coremap[page].cme_zeroed = false;
+	list_push(&freelists[order], page);
+	coremap_nblocks[order]++;
+}
+
+static
+void
+block_remove(unsigned page, unsigned order)
+{
+	KASSERT(coremap[page].cme_state == CME_FREE);
+	KASSERT(coremap[page].cme_npages == 1U << order);
+	list_remove(&freelists[order], page);
+	coremap_nblocks[order]--;
+	coremap[page].cme_npages = 0;
+}
+
+/*
+ * Free one page, merging it with its buddy for as long as the buddy
+ * is a free block of the same size. (Pages below the first free page
+ * are fixed and past the end there are none, so merging stops there.)
+ */
+static
+void
+buddy_free(unsigned page)
+{
+	unsigned order, buddy;
+
+	coremap[page].cme_state = CME_FREE;
+	coremap[page].cme_npages = 0;
+	coremap[page].cme_refcount = 0;
+	coremap[page].cme_zeroed = false;
+	cme_clear(&coremap[page]);
+	coremap_nfree++;
+
+	for (order = 0; order < COREMAP_MAXORDER; order++) {
+		buddy = page ^ (1U << order);
+		if (buddy >= coremap_npages ||
+		    coremap[buddy].cme_state != CME_FREE ||
+		    coremap[buddy].cme_npages != 1U << order ||
+		    coremap[buddy].cme_zeroed) {
+			break;
+		}
+		block_remove(buddy, order);
+		coremap_merges++;
+		if (buddy < page) {
+			page = buddy;
+		}
+	}
+	block_push(page, order);
+}
+
+/*
+ * Take a free block of 2^ORDER pages, splitting a bigger one if there
+ * is none of that size. Returns CM_NONE if there is no big enough
+ * block.
+ */
+static
+unsigned
+buddy_alloc(unsigned order)
+{
+	unsigned k, page;
+
+	for (k = order; k < COREMAP_NORDERS; k++) {
+		if (freelists[k] != CM_NONE) {
+			break;
+		}
+	}
+	if (k == COREMAP_NORDERS) {
+		return CM_NONE;
+	}
+
+	page = freelists[k];
+	block_remove(page, k);
+	while (k > order) {
+		/* keep the lower half, give back the upper one */
+		k--;
+		block_push(page + (1U << k), k);
+		coremap_splits++;
+	}
+	coremap_nfree -= 1U << order;
+	return page;
+}
+
+/*
+ * Smallest order of block that holds NPAGES pages.
+ */
+static
+unsigned
+buddy_order(unsigned npages)
+{
+	unsigned order;
+
+	for (order = 0; (1U << order) < npages; order++) {
+		/* nothing */
+	}
+	return order;
+}
+
+/*
+ * The zero list: single free pages known to be all zeros. They are
+ * kept out of the buddy system (so they are not merged and handed out
+ * as part of bigger blocks) until somebody needs them.
+ */
+static
+void
+zerolist_push(unsigned page)
+{
+	coremap[page].cme_state = CME_FREE;
+	coremap[page].cme_npages = 1;
+	coremap[page].cme_refcount = 0;
+	coremap[page].cme_zeroed = true;
+	cme_clear(&coremap[page]);
+	list_push(&zerolist_head, page);
+	coremap_nzero++;
+	coremap_nfree++;
+}
+
+static
+unsigned
+zerolist_pop(void)
+{
+	unsigned page;
+
+	page = zerolist_head;
+	if (page == CM_NONE) {
+		return CM_NONE;
+	}
+	list_remove(&zerolist_head, page);
+	coremap[page].cme_npages = 0;
+	coremap[page].cme_zeroed = false;
+	coremap_nzero--;
+	coremap_nfree--;
+	return page;
+}
+
+/*
+ * Take over physical memory. The coremap itself is stolen from the
+ * bottom of free memory, so it ends up among the fixed pages.
+ */
+void
+coremap_bootstrap(void)
+{
+	paddr_t firstfree, lastpaddr, cmpaddr;
+	unsigned cmpages, firstpage, i;
+
+	lastpaddr = ram_getsize();
+	coremap_npages = lastpaddr / PAGE_SIZE;
+
+	cmpages = (coremap_npages * sizeof(struct coremap_entry)
+		   + PAGE_SIZE - 1) / PAGE_SIZE;
+	cmpaddr = ram_stealmem(cmpages);
+	if (cmpaddr == 0) {
+		panic("coremap: no memory for the coremap\n");
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cmpaddr);
+
+	/* No more ram_stealmem after this. */
+	firstfree = ram_getfirstfree();
+	firstpage = firstfree / PAGE_SIZE;
+
+	/* Everything starts out fixed... */
+	for (i = 0; i < coremap_npages; i++) {
+		coremap[i].cme_state = CME_FIXED;
+		coremap[i].cme_npages = 1;
+		coremap[i].cme_refcount = 0;
+		cme_clear(&coremap[i]);
+		coremap[i].cme_zeroed = false;
+		coremap[i].cme_prev = coremap[i].cme_next = CM_NONE;
+	}
+	for (i = 0; i < COREMAP_NORDERS; i++) {
+		freelists[i] = CM_NONE;
+	}
+
+	/* ...then the free pages are freed, merging as we go. */
+	for (i = firstpage; i < coremap_npages; i++) {
+		buddy_free(i);
+	}
+	coremap_nmanaged = coremap_npages - firstpage;
+	coremap_zerotarget = coremap_nmanaged / COREMAP_ZERO_FRACTION;
+
+	kprintf("coremap: %u pages, %u free\n", coremap_npages, coremap_nfree);
+
+	/* Now kmalloc works. */
+	coremap_wchan = wchan_create("coremap");
+	pageout_wchan = wchan_create("pageout");
+	if (coremap_wchan == NULL || pageout_wchan == NULL) {
+		panic("coremap: cannot create wchans\n");
+	}
+}
+
+/*
+ * Hand out the NPAGES pages starting at PAGE, which the caller has
+ * taken off the free lists, in state STATE. Must hold coremap_lock.
+ */
+static
+void
+coremap_take(unsigned page, unsigned npages, unsigned state)
+{
+	unsigned i;
+
+	for (i = 0; i < npages; i++) {
+		coremap[page + i].cme_state = state;
+		coremap[page + i].cme_npages = 0;
+		coremap[page + i].cme_refcount = 1;
+	}
+	coremap[page].cme_npages = npages;
+	if (state == CME_USER) {
+		/* nothing in swap yet, and not evictable until it has an owner */
+		coremap[page].cme_busy = true;
+		coremap[page].cme_dirty = true;
+	}
+
+	if (coremap_nfree < coremap_lowwater) {
+		wchan_wakeone(pageout_wchan, &coremap_lock);
+	}
+}
+
+paddr_t
+coremap_alloc(unsigned npages, unsigned state)
+{
+	unsigned page, order, i;
+	paddr_t paddr;
+
+	KASSERT(npages > 0);
+	KASSERT(state == CME_KERNEL || state == CME_USER);
+
+	spinlock_acquire(&coremap_lock);
+
+	if (coremap == NULL) {
+		/* Too early; not ours to manage yet. */
+		paddr = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return paddr;
+	}
+
+	if (coremap_nfree < npages) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	if (npages == 1) {
+		/* leave the zeroed pages for those who want them */
+		page = buddy_alloc(0);
+		if (page == CM_NONE) {
+			page = zerolist_pop();
+		}
+		KASSERT(page != CM_NONE);
+		coremap_take(page, 1, state);
+		spinlock_release(&coremap_lock);
+		return (paddr_t)page * PAGE_SIZE;
+	}
+
+	order = buddy_order(npages);
+	page = CM_NONE;
+	if (order <= COREMAP_MAXORDER) {
+		page = buddy_alloc(order);
+		if (page == CM_NONE && coremap_nzero > 0) {
+			/* Zeroed pages may be what keeps buddies apart. */
+			while ((i = zerolist_pop()) != CM_NONE) {
+				buddy_free(i);
+			}
+			page = buddy_alloc(order);
+		}
+	}
+	if (page == CM_NONE) {
+		coremap_allocfails++;
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	/* Use the front of the block and give back the rest. */
+	coremap_take(page, npages, state);
+	for (i = npages; i < (1U << order); i++) {
+		buddy_free(page + i);
+	}
+
+	spinlock_release(&coremap_lock);
+
+	return (paddr_t)page * PAGE_SIZE;
+}
+
+paddr_t
+coremap_alloc_zeroed(void)
+{
+	unsigned page;
+	bool zeroed;
+
+	spinlock_acquire(&coremap_lock);
+
+	KASSERT(coremap != NULL);
+
+	page = zerolist_pop();
+	if (page != CM_NONE) {
+		zeroed = true;
+		coremap_zerohits++;
+	}
+	else {
+		page = buddy_alloc(0);
+		if (page == CM_NONE) {
+			spinlock_release(&coremap_lock);
+			return 0;
+		}
+		zeroed = false;
+		coremap_zeromisses++;
+	}
+
+	coremap_take(page, 1, CME_USER);
+
+	spinlock_release(&coremap_lock);
+
+	if (!zeroed) {
+		bzero((void *)PADDR_TO_KVADDR((paddr_t)page * PAGE_SIZE),
+		      PAGE_SIZE);
+	}
+
+	return (paddr_t)page * PAGE_SIZE;
+}
+
+/*
+ * Called by idle cpus. The page is taken out of the buddy system while
+ * it is zeroed so that nobody allocates it meanwhile, and so that the
+ * zeroing happens without coremap_lock held.
+ */
+bool
+coremap_zero_one(void)
+{
+	unsigned page;
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap == NULL || coremap_nzero >= coremap_zerotarget) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	page = buddy_alloc(0);
+	if (page == CM_NONE) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	coremap[page].cme_state = CME_ZEROING;
+	spinlock_release(&coremap_lock);
+
+	bzero((void *)PADDR_TO_KVADDR((paddr_t)page * PAGE_SIZE), PAGE_SIZE);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[page].cme_state == CME_ZEROING);
+	zerolist_push(page);
+	coremap_idlezeroed++;
+	spinlock_release(&coremap_lock);
+
+	return true;
+}
+
+void
+coremap_zerostats(struct coremap_zerostats *zs)
+{
+	spinlock_acquire(&coremap_lock);
+	zs->zs_pool = coremap_nzero;
+	zs->zs_target = coremap_zerotarget;
+	zs->zs_hits = coremap_zerohits;
+	zs->zs_misses = coremap_zeromisses;
+	zs->zs_idlezeroed = coremap_idlezeroed;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Print the buddy allocator statistics. External fragmentation is
+ * the share of free memory that is not in the largest free block:
+ * 0% means all of it could be handed out in one piece.
+ */
+void
+coremap_printstats(void)
+{
+	unsigned nblocks[COREMAP_NORDERS];
+	unsigned nfree, nzero, splits, merges, fails, largest, i;
+
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i < COREMAP_NORDERS; i++) {
+		nblocks[i] = coremap_nblocks[i];
+	}
+	nfree = coremap_nfree;
+	nzero = coremap_nzero;
+	splits = coremap_splits;
+	merges = coremap_merges;
+	fails = coremap_allocfails;
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: free blocks by order:");
+	largest = 0;
+	for (i = 0; i < COREMAP_NORDERS; i++) {
+		kprintf(" %u", nblocks[i]);
+		if (nblocks[i] > 0) {
+			largest = 1U << i;
+		}
+	}
+	kprintf("\n");
+	if (largest == 0 && nzero > 0) {
+		/* the zero list holds single pages */
+		largest = 1;
+	}
+	kprintf("coremap: largest free block %u pages, "
+		"%u%% fragmentation\n", largest,
+		nfree == 0 ? 0 : 100 - largest * 100 / nfree);
+	kprintf("coremap: %u splits, %u merges, "
+		"%u multi-page allocations failed\n", splits, merges, fails);
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	unsigned page, npages, i, slot;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	page = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+
+	KASSERT(coremap != NULL);
+	KASSERT(page < coremap_npages);
+
+	if (coremap[page].cme_state == CME_FIXED) {
+		/* Allocated before the coremap existed; cannot be freed. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	KASSERT(coremap[page].cme_state == CME_KERNEL ||
+		coremap[page].cme_state == CME_USER);
+	npages = coremap[page].cme_npages;
+	KASSERT(npages > 0);
+
+	slot = SWAP_NOSLOT;
+	if (coremap[page].cme_state == CME_USER) {
+		KASSERT(npages == 1);
+		KASSERT(coremap[page].cme_busy);
+		KASSERT(coremap[page].cme_refcount > 0);
+		coremap[page].cme_refcount--;
+		wchan_wakeall(coremap_wchan, &coremap_lock);
+		if (coremap[page].cme_refcount > 0) {
+			/* still mapped by some other address space */
+			coremap[page].cme_busy = false;
+			spinlock_release(&coremap_lock);
+			return;
+		}
+		KASSERT(coremap[page].cme_cache == NULL);
+		slot = coremap[page].cme_swapslot;
+	}
+
+	for (i = 0; i < npages; i++) {
+		KASSERT(coremap[page + i].cme_state ==
+			coremap[page].cme_state);
+		buddy_free(page + i);
+	}
+
+	spinlock_release(&coremap_lock);
+
+	if (slot != SWAP_NOSLOT) {
+		swap_free(slot);
+	}
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	unsigned page;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	page = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(page < coremap_npages);
+	KASSERT(coremap[page].cme_state == CME_USER);
+	KASSERT(coremap[page].cme_refcount > 0);
+	coremap[page].cme_refcount++;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	unsigned page, refcount;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	page = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(page < coremap_npages);
+	refcount = coremap[page].cme_refcount;
+	spinlock_release(&coremap_lock);
+
+	return refcount;
+}
+
+unsigned
+coremap_freepages(void)
+{
+	unsigned nfree;
+
+	spinlock_acquire(&coremap_lock);
+	nfree = coremap_nfree;
+	spinlock_release(&coremap_lock);
+
+	return nfree;
+}
+
+unsigned
+coremap_totalpages(void)
+{
+	/* constant once bootstrapped */
+	return coremap_nmanaged;
+}
+
+/*
+ * Look up the entry for a user page the caller has pinned.
+ * Call with coremap_lock held.
+ */
+static
+struct coremap_entry *
+coremap_pinned(paddr_t paddr)
+{
+	unsigned page;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	page = paddr / PAGE_SIZE;
+	KASSERT(page < coremap_npages);
+	KASSERT(coremap[page].cme_state == CME_USER);
+	KASSERT(coremap[page].cme_busy);
+
+	return &coremap[page];
+}
+
+bool
+coremap_pin(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+	unsigned page;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	page = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(page < coremap_npages);
+	cme = &coremap[page];
+	if (cme->cme_state != CME_USER) {
+		/* freed (or reused) under us */
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	if (cme->cme_busy) {
+		wchan_sleep(coremap_wchan, &coremap_lock);
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	cme->cme_busy = true;
+	spinlock_release(&coremap_lock);
+
+	return true;
+}
+
+void
+coremap_unpin(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_pinned(paddr);
+	cme->cme_busy = false;
+	wchan_wakeall(coremap_wchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_decref(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_pinned(paddr);
+	KASSERT(cme->cme_refcount > 1);
+	cme->cme_refcount--;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_pinned(paddr);
+	cme->cme_as = as;
+	cme->cme_vaddr = vaddr;
+	cme->cme_referenced = true;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setcache(paddr_t paddr, struct pagecache *pc, unsigned idx)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_pinned(paddr);
+	KASSERT(cme->cme_as == NULL);
+	cme->cme_cache = pc;
+	cme->cme_cacheidx = idx;
+	cme->cme_referenced = true;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setclean(paddr_t paddr, unsigned slot)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(slot != SWAP_NOSLOT);
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_pinned(paddr);
+	KASSERT(cme->cme_swapslot == SWAP_NOSLOT ||
+		cme->cme_swapslot == slot);
+	cme->cme_swapslot = slot;
+	cme->cme_dirty = false;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_setdirty(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+	unsigned slot;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_pinned(paddr);
+	slot = cme->cme_swapslot;
+	cme->cme_swapslot = SWAP_NOSLOT;
+	cme->cme_dirty = true;
+	spinlock_release(&coremap_lock);
+
+	return slot;
+}
+
+bool
+coremap_isdirty(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+	bool dirty;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_pinned(paddr);
+	dirty = cme->cme_dirty;
+	spinlock_release(&coremap_lock);
+
+	return dirty;
+}
+
+unsigned
+coremap_getslot(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+	unsigned slot;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_pinned(paddr);
+	slot = cme->cme_swapslot;
+	spinlock_release(&coremap_lock);
+
+	return slot;
+}
+
+void
+coremap_setslot(paddr_t paddr, unsigned slot)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_pinned(paddr);
+	cme->cme_swapslot = slot;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Clock replacement. There are no hardware reference bits on the
+ * MIPS, so a page counts as referenced when the fault handler maps
+ * it; a page that stays in the TLB for a long time therefore looks
+ * idle to the clock. Two sweeps are enough to find a victim if there
+ * is one at all.
+ *
+ * Pages in a page cache have no owner; they are candidates as long
+ * as they are not pinned, whoever maps them, and pagecache_evict
+ * finds the mappings. Whether they were used since the hand last
+ * passed is only known for certain from those mappings, so the
+ * second chance given here covers just the time since they were
+ * looked up in the cache.
+ */
+paddr_t
+coremap_pickvictim(struct addrspace **as, vaddr_t *vaddr,
+		   struct pagecache **pc, unsigned *idx)
+{
+	struct coremap_entry *cme;
+	unsigned n, page;
+	pte_t *pte;
+
+	spinlock_acquire(&coremap_lock);
+
+	for (n = 0; n < 2 * coremap_npages; n++) {
+		page = clock_hand;
+		clock_hand = (clock_hand + 1) % coremap_npages;
+
+		cme = &coremap[page];
+		if (cme->cme_state != CME_USER || cme->cme_busy) {
+			continue;
+		}
+		if (cme->cme_cache == NULL &&
+		    (cme->cme_as == NULL || cme->cme_refcount != 1)) {
+			continue;
+		}
+		if (cme->cme_referenced && cme->cme_cache != NULL) {
+			cme->cme_referenced = false;
+			continue;
+		}
+		if (cme->cme_referenced) {
+			/*
+			 * Second chance. TLB misses on the page only
+			 * go to vm_fault, and mark it referenced again,
+			 * if the fast refill path may not load it.
+			 */
+			cme->cme_referenced = false;
+			pte = pt_lookup(cme->cme_as->as_pt, cme->cme_vaddr,
+					false);
+			KASSERT(pte != NULL);
+			*pte &= ~(pte_t)(PTE_TLBVALID | PTE_TLBDIRTY);
+			continue;
+		}
+
+		cme->cme_busy = true;
+		*as = cme->cme_as;
+		*vaddr = cme->cme_vaddr;
+		*pc = cme->cme_cache;
+		*idx = cme->cme_cacheidx;
+		spinlock_release(&coremap_lock);
+		return (paddr_t)page * PAGE_SIZE;
+	}
+
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+void
+coremap_setwatermark(unsigned lowwater)
+{
+	spinlock_acquire(&coremap_lock);
+	coremap_lowwater = lowwater;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_pageout_wait(bool stalled)
+{
+	spinlock_acquire(&coremap_lock);
+	if (stalled) {
+		wchan_sleep(pageout_wchan, &coremap_lock);
+	}
+	while (coremap_nfree >= coremap_lowwater) {
+		wchan_sleep(pageout_wchan, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+}
@@ -0,0 +1,607 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel heap profiler.
+ *
+ * Each cpu has its own counters, one set per call site and one per
+ * size class, so counting an allocation touches no shared cache line
+ * except the lock of the block table (below). That lock is still a
+ * cross-cpu lock on every kmalloc and kfree, which the per-cpu
+ * magazines in kmalloc.c otherwise keep off the common path, so the
+ * profiler starts out off and is only turned on to look for a leak. The call sites are kept
+ * in a small open hash table that only ever gains entries; once it is
+ * full, further sites are all counted under the last entry, "other".
+ *
+ * To charge a kfree to the kmalloc that made the block, the profiler
+ * remembers each block it counted in a hash table split into shards
+ * by address, each with its own lock and its own pool of entries, so
+ * cpus freeing unrelated blocks do not contend. If a shard's pool runs
+ * out the allocation is not tracked, and only counted as "untracked":
+ * counting it under its site and class would make it look live
+ * forever, since its kfree cannot be charged back. A kfree of a block
+ * that is not in the table (allocated before profiling was turned on,
+ * or untracked) is likewise only counted as such. All updates of the per-cpu counters are made holding a shard
+ * lock, so holding all of them stops the counters for a reset.
+ *
+ * Nothing here calls kmalloc once the profiler is running, since that
+ * would come right back here.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <stdarg.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <cpu.h>
+#include <current.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <vm.h>
+#include <kheapprof.h>
+
+#define KHPROF_NCLASSES	 9	/* 16, 32, ... 2048 bytes, then more */
+#define KHPROF_NSITES	 128	/* call sites, including "other" */
+#define KHPROF_NSHARDS	 8	/* separately locked parts of block table */
+#define KHPROF_NBUCKETS	 64	/* hash chains per shard */
+#define KHPROF_NBLOCKS	 256	/* blocks tracked per shard */
+#define KHPROF_REPORTMAX (3 * PAGE_SIZE)
+
+#define KHPROF_OTHER	 (KHPROF_NSITES - 1)
+
+struct khprof_count {
+	unsigned kc_allocs;
+	unsigned kc_frees;
+	unsigned kc_bytes;		/* bytes allocated */
+	unsigned kc_freedbytes;		/* of those, bytes freed */
+};
+
+struct khprof_cpu {
+	struct khprof_count kp_sites[KHPROF_NSITES];
+	struct khprof_count kp_classes[KHPROF_NCLASSES];
+	unsigned kp_untracked;		/* allocations not tracked */
+	unsigned kp_unknownfrees;	/* frees of blocks not tracked */
+};
+
+struct khprof_block {
+	struct khprof_block *kb_next;
+	vaddr_t kb_addr;
+	uint32_t kb_size;
+	uint16_t kb_site;
+	uint16_t kb_class;
+};
+
+struct khprof_shard {
+	struct spinlock ks_lock;
+	struct khprof_block *ks_buckets[KHPROF_NBUCKETS];
+	struct khprof_block *ks_free;	/* unused entries */
+	struct khprof_block *ks_pool;	/* all the entries */
+};
+
+volatile bool kheapprof_enabled;
+
+static struct khprof_cpu *khprof_cpus;
+static unsigned khprof_ncpus;
+
+static vaddr_t khprof_sites[KHPROF_NSITES];
+static struct spinlock khprof_sitelock = SPINLOCK_INITIALIZER;
+
+static struct khprof_shard khprof_shards[KHPROF_NSHARDS];
+
+/*
+ * The report, as last generated, and space for making it (too big
+ * for the stack); khprof_lock also covers turning the profiler on
+ * and off.
+ */
+static struct lock *khprof_lock;
+static char *khprof_report;
+static size_t khprof_reportlen;
+static struct khprof_count khprof_sums[KHPROF_NSITES];
+static unsigned khprof_order[KHPROF_NSITES];
+
+////////////////////////////////////////////////////////////
+// Counting
+
+/*
+ * Get the index of call site SITE, adding it if it is new.
+ */
+static
+unsigned
+khprof_siteindex(vaddr_t site)
+{
+	unsigned i, n;
+
+	i = (site >> 2) % KHPROF_OTHER;
+	for (n = 0; n < KHPROF_OTHER; n++) {
+		if (khprof_sites[i] == site) {
+			return i;
+		}
+		if (khprof_sites[i] == 0) {
+			spinlock_acquire(&khprof_sitelock);
+			if (khprof_sites[i] == 0) {
+				khprof_sites[i] = site;
+			}
+			spinlock_release(&khprof_sitelock);
+			if (khprof_sites[i] == site) {
+				return i;
+			}
+			/* someone else just took it */
+		}
+		i = (i + 1) % KHPROF_OTHER;
+	}
+	return KHPROF_OTHER;
+}
+
+/*
+ * Get the size class of an allocation of SIZE bytes.
+ */
+static
+unsigned
+khprof_class(size_t size)
+{
+	unsigned cls;
+
+	for (cls = 0; cls < KHPROF_NCLASSES - 1; cls++) {
+		if (size <= (16U << cls)) {
+			break;
+		}
+	}
+	return cls;
+}
+
+/*
+ * Find the shard, and the hash chain in it, of the block at ADDR.
+ * Blocks are at least 16 bytes apart, so neighbours go to different
+ * shards.
+ */
+static
+struct khprof_block **
+khprof_bucket(vaddr_t addr, struct khprof_shard **ret)
+{
+	unsigned h;
+
+	h = addr >> 4;
+	*ret = &khprof_shards[h % KHPROF_NSHARDS];
+	return &(*ret)->ks_buckets[(h / KHPROF_NSHARDS) % KHPROF_NBUCKETS];
+}
+
+/*
+ * Count an allocation of SIZE bytes at PTR by the caller at SITE.
+ */
+void
+kheapprof_alloc(void *ptr, size_t size, vaddr_t site)
+{
+	struct khprof_shard *ks;
+	struct khprof_block **bucket, *kb;
+	struct khprof_cpu *kp;
+	unsigned siteix, cls;
+
+	if (ptr == NULL || !CURCPU_EXISTS()) {
+		return;
+	}
+
+	siteix = khprof_siteindex(site);
+	cls = khprof_class(size);
+	bucket = khprof_bucket((vaddr_t)ptr, &ks);
+
+	spinlock_acquire(&ks->ks_lock);
+
+	kb = ks->ks_free;
+	if (kb != NULL) {
+		ks->ks_free = kb->kb_next;
+		kb->kb_addr = (vaddr_t)ptr;
+		kb->kb_size = size;
+		kb->kb_site = siteix;
+		kb->kb_class = cls;
+		kb->kb_next = *bucket;
+		*bucket = kb;
+	}
+
+	/* we can't switch cpus while holding a spinlock */
+	KASSERT(curcpu->c_number < khprof_ncpus);
+	kp = &khprof_cpus[curcpu->c_number];
+	if (kb != NULL) {
+		kp->kp_sites[siteix].kc_allocs++;
+		kp->kp_sites[siteix].kc_bytes += size;
+		kp->kp_classes[cls].kc_allocs++;
+		kp->kp_classes[cls].kc_bytes += size;
+	}
+	else {
+		kp->kp_untracked++;
+	}
+
+	spinlock_release(&ks->ks_lock);
+}
+
+/*
+ * Count the freeing of the block at PTR.
+ */
+void
+kheapprof_free(void *ptr)
+{
+	struct khprof_shard *ks;
+	struct khprof_block **kbp, *kb;
+	struct khprof_cpu *kp;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	kbp = khprof_bucket((vaddr_t)ptr, &ks);
+
+	spinlock_acquire(&ks->ks_lock);
+
+	for (; *kbp != NULL; kbp = &(*kbp)->kb_next) {
+		if ((*kbp)->kb_addr == (vaddr_t)ptr) {
+			break;
+		}
+	}
+	kb = *kbp;
+
+	KASSERT(curcpu->c_number < khprof_ncpus);
+	kp = &khprof_cpus[curcpu->c_number];
+	if (kb != NULL) {
+		*kbp = kb->kb_next;
+		kp->kp_sites[kb->kb_site].kc_frees++;
+		kp->kp_sites[kb->kb_site].kc_freedbytes += kb->kb_size;
+		kp->kp_classes[kb->kb_class].kc_frees++;
+		kp->kp_classes[kb->kb_class].kc_freedbytes += kb->kb_size;
+		kb->kb_next = ks->ks_free;
+		ks->ks_free = kb;
+	}
+	else {
+		kp->kp_unknownfrees++;
+	}
+
+	spinlock_release(&ks->ks_lock);
+}
+
+/*
+ * Forget all tracked blocks and, if COUNTS, zero the counters.
+ */
+static
+void
+khprof_clear(bool counts)
+{
+	unsigned i, j;
+
+	for (i = 0; i < KHPROF_NSHARDS; i++) {
+		spinlock_acquire(&khprof_shards[i].ks_lock);
+	}
+
+	for (i = 0; i < KHPROF_NSHARDS; i++) {
+		struct khprof_shard *ks = &khprof_shards[i];
+
+		for (j = 0; j < KHPROF_NBUCKETS; j++) {
+			ks->ks_buckets[j] = NULL;
+		}
+		ks->ks_free = NULL;
+		for (j = 0; j < KHPROF_NBLOCKS; j++) {
+			ks->ks_pool[j].kb_next = ks->ks_free;
+			ks->ks_free = &ks->ks_pool[j];
+		}
+	}
+	if (counts) {
+		bzero(khprof_cpus, khprof_ncpus * sizeof(khprof_cpus[0]));
+	}
+
+	for (i = KHPROF_NSHARDS; i-- > 0; ) {
+		spinlock_release(&khprof_shards[i].ks_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Control and reporting
+
+/*
+ * Carry out a command written to kheap:, or given to the menu.
+ */
+int
+kheapprof_command(const char *cmd)
+{
+	lock_acquire(khprof_lock);
+	if (!strcmp(cmd, "on")) {
+		kheapprof_enabled = false;
+		khprof_clear(true);
+		kheapprof_enabled = true;
+	}
+	else if (!strcmp(cmd, "off")) {
+		/* once off, frees go unseen, so forget the blocks */
+		kheapprof_enabled = false;
+		khprof_clear(false);
+	}
+	else if (!strcmp(cmd, "reset")) {
+		khprof_clear(true);
+	}
+	else {
+		lock_release(khprof_lock);
+		return EINVAL;
+	}
+	lock_release(khprof_lock);
+	return 0;
+}
+
+/*
+ * Add the counters of all cpus for one site or class.
+ */
+static
+void
+khprof_sum(struct khprof_count *sum, bool site, unsigned index)
+{
+	struct khprof_count *kc;
+	unsigned i;
+
+	bzero(sum, sizeof(*sum));
+	for (i = 0; i < khprof_ncpus; i++) {
+		kc = site ? &khprof_cpus[i].kp_sites[index] :
+			&khprof_cpus[i].kp_classes[index];
+		sum->kc_allocs += kc->kc_allocs;
+		sum->kc_frees += kc->kc_frees;
+		sum->kc_bytes += kc->kc_bytes;
+		sum->kc_freedbytes += kc->kc_freedbytes;
+	}
+}
+
+/*
+ * Append to the report.
+ */
+static void khprof_printf(const char *fmt, ...) __PF(1,2);
+
+static
+void
+khprof_printf(const char *fmt, ...)
+{
+	va_list ap;
+	size_t room;
+
+	room = KHPROF_REPORTMAX - khprof_reportlen;
+	va_start(ap, fmt);
+	vsnprintf(khprof_report + khprof_reportlen, room, fmt, ap);
+	va_end(ap);
+	khprof_reportlen += strlen(khprof_report + khprof_reportlen);
+}
+
+/*
+ * Regenerate the report. Call with khprof_lock held.
+ *
+ * The counters are read without stopping anyone, so they can be a
+ * little inconsistent with each other; it is only statistics.
+ */
+static
+void
+khprof_generate(void)
+{
+	struct khprof_count *sums = khprof_sums, sum;
+	unsigned *order = khprof_order;
+	unsigned i, j, n, untracked, unknownfrees;
+
+	KASSERT(lock_do_i_hold(khprof_lock));
+	khprof_reportlen = 0;
+	khprof_report[0] = '\0';
+
+	khprof_printf("Kernel heap profile (%s)\n",
+		      kheapprof_enabled ? "on" : "off");
+
+	khprof_printf("%-12s %8s %8s %8s %10s\n", "size", "allocs",
+		      "frees", "live", "live bytes");
+	for (i = 0; i < KHPROF_NCLASSES; i++) {
+		khprof_sum(&sum, false, i);
+		if (i < KHPROF_NCLASSES - 1) {
+			khprof_printf("<= %-9u", 16U << i);
+		}
+		else {
+			khprof_printf("%-12s", "larger");
+		}
+		khprof_printf(" %8u %8u %8u %10u\n", sum.kc_allocs,
+			      sum.kc_frees, sum.kc_allocs - sum.kc_frees,
+			      sum.kc_bytes - sum.kc_freedbytes);
+	}
+
+	/* sites with any allocations, most live bytes first */
+	n = 0;
+	for (i = 0; i < KHPROF_NSITES; i++) {
+		khprof_sum(&sums[i], true, i);
+		if (sums[i].kc_allocs == 0) {
+			continue;
+		}
+		for (j = n; j > 0; j--) {
+			if (sums[order[j-1]].kc_bytes -
+			    sums[order[j-1]].kc_freedbytes >=
+			    sums[i].kc_bytes - sums[i].kc_freedbytes) {
+				break;
+			}
+			order[j] = order[j-1];
+		}
+		order[j] = i;
+		n++;
+	}
+
+	khprof_printf("%-12s %8s %8s %8s %10s\n", "call site", "allocs",
+		      "frees", "live", "live bytes");
+	for (j = 0; j < n; j++) {
+		i = order[j];
+		if (i == KHPROF_OTHER) {
+			khprof_printf("%-12s", "other");
+		}
+		else {
+			khprof_printf("0x%08lx  ",
+				      (unsigned long)khprof_sites[i]);
+		}
+		khprof_printf(" %8u %8u %8u %10u\n", sums[i].kc_allocs,
+			      sums[i].kc_frees,
+			      sums[i].kc_allocs - sums[i].kc_frees,
+			      sums[i].kc_bytes - sums[i].kc_freedbytes);
+	}
+
+	untracked = unknownfrees = 0;
+	for (i = 0; i < khprof_ncpus; i++) {
+		untracked += khprof_cpus[i].kp_untracked;
+		unknownfrees += khprof_cpus[i].kp_unknownfrees;
+	}
+	khprof_printf("not counted above: %u allocs (table full), "
+		      "%u frees (of those, or of blocks allocated before "
+		      "profiling)\n", untracked, unknownfrees);
+}
+
+/*
+ * Print the report on the console.
+ */
+void
+kheapprof_print(void)
+{
+	lock_acquire(khprof_lock);
+	khprof_generate();
+	kprintf("%s", khprof_report);
+	lock_release(khprof_lock);
+}
+
+////////////////////////////////////////////////////////////
+// The kheap: device
+
+static
+int
+khprof_eachopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+
+	return 0;
+}
+
+/*
+ * Reading gets the report, which is generated afresh when reading
+ * from the start. Writing carries out a command.
+ */
+static
+int
+khprof_io(struct device *dev, struct uio *uio)
+{
+	char cmd[16];
+	size_t len;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw == UIO_WRITE) {
+		len = uio->uio_resid;
+		if (len >= sizeof(cmd)) {
+			return EINVAL;
+		}
+		result = uiomove(cmd, len, uio);
+		if (result) {
+			return result;
+		}
+		/* allow a trailing newline */
+		if (len > 0 && cmd[len-1] == '\n') {
+			len--;
+		}
+		cmd[len] = '\0';
+		return kheapprof_command(cmd);
+	}
+
+	if (uio->uio_offset < 0) {
+		return EINVAL;
+	}
+
+	lock_acquire(khprof_lock);
+	if (uio->uio_offset == 0) {
+		khprof_generate();
+	}
+	result = 0;
+	if (uio->uio_offset < (off_t)khprof_reportlen) {
+		len = khprof_reportlen - uio->uio_offset;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(khprof_report + uio->uio_offset, len, uio);
+	}
+	lock_release(khprof_lock);
+	return result;
+}
+
+static
+int
+khprof_ioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops khprof_devops = {
+	.devop_eachopen = khprof_eachopen,
+	.devop_io = khprof_io,
+	.devop_ioctl = khprof_ioctl,
+};
+
+/*
+ * Set up the profiler and attach kheap:. Profiling stays off until
+ * turned on.
+ */
+void
+kheapprof_bootstrap(void)
+{
+	struct device *dev;
+	struct khprof_block *pool;
+	unsigned i;
+	int result;
+
+	khprof_ncpus = cpu_count();
+	khprof_cpus = kmalloc(khprof_ncpus * sizeof(khprof_cpus[0]));
+	pool = kmalloc(KHPROF_NSHARDS * KHPROF_NBLOCKS * sizeof(*pool));
+	khprof_report = kmalloc(KHPROF_REPORTMAX);
+	khprof_lock = lock_create("kheapprof");
+	dev = kmalloc(sizeof(*dev));
+	if (khprof_cpus == NULL || pool == NULL || khprof_report == NULL ||
+	    khprof_lock == NULL || dev == NULL) {
+		panic("kheapprof_bootstrap: Out of memory\n");
+	}
+
+	for (i = 0; i < KHPROF_NSHARDS; i++) {
+		spinlock_init(&khprof_shards[i].ks_lock);
+		khprof_shards[i].ks_pool = &pool[i * KHPROF_NBLOCKS];
+	}
+	khprof_clear(true);
+
+	dev->d_ops = &khprof_devops;
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+	dev->d_data = NULL;
+
+	result = vfs_adddev("kheap", dev, 0);
+	if (result) {
+		panic("kheapprof_bootstrap: vfs_adddev: %s\n",
+		      strerror(result));
+	}
+}
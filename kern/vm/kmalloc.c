@@ -29,8 +29,13 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <kheapprof.h>
+#include <platform/maxcpus.h>
 
 /*
  * Kernel malloc.
@@ -73,10 +78,12 @@ fill_deadbeef(void *vptr, size_t len)
 //    more blocks would fit on a page than with the existing block
 //    sizes, and large numbers of items of the new size are allocated.
 //
-//    The free counts and addresses of the pages are maintained in
-//    another list.  Maintaining this table is a nuisance, because it
-//    cannot recursively use the subpage allocator. (We could probably
-//    make that work, but it would be painful.)
+//    The free counts and free lists of the pages are kept in a table
+//    with an entry (a pageref) for every physical page, allocated at
+//    boot, so that the entry for the page a block is on is found
+//    directly from the block's address. The pages of each size that
+//    have free blocks are on a list, so we can find one to allocate
+//    from without looking at the full ones.
 //
 
 ////////////////////////////////////////
@@ -131,6 +138,10 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #define SMALLEST_SUBPAGE_SIZE 16
 #define LARGEST_SUBPAGE_SIZE 2048
 
+/* Capacity of the per-cpu magazine for each size (see below) */
+#define MAXMAGSIZE 32
+static const unsigned magsizes[NSIZES] = { 32, 32, 32, 32, 16, 8, 4, 4 };
+
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
 #else
@@ -145,8 +156,8 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
-	vaddr_t pageaddr_and_blocktype;
+	struct pageref **pprev_samesize;	/* what points to us */
+	vaddr_t pageaddr_and_blocktype;		/* 0 if not a heap page */
 	uint16_t freelist_offset;
 	uint16_t nfree;
 };
@@ -160,10 +171,8 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the pages. Most allocations and frees do not
+ * get that far, though; see the magazines below.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -171,182 +180,110 @@ static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 ////////////////////////////////////////
 
 /*
- * We can only allocate whole pages of pageref structure at a time.
- * This is a struct type for such a page.
+ * Per-cpu magazines.
+ *
+ * In front of the pages there is, for each cpu and each block size, a
+ * magazine: a short list of free blocks, linked through their first
+ * word like the free lists of the pages, that only that cpu touches
+ * and only with interrupts off. kmalloc takes a block out of the
+ * current cpu's magazine and kfree puts one back without taking
+ * kmalloc_spinlock. Only when a magazine is empty (or full) does a
+ * batch of half its capacity come from (or go back to) the pages,
+ * under the lock.
+ *
+ * As far as the pages are concerned, blocks in magazines are
+ * allocated, so they keep their pages from being freed; magsizes[]
+ * keeps that to about two pages' worth per cpu per size.
+ *
+ * To put a block in a magazine kfree needs its size, which it reads
+ * from the block's pageref without the lock. That is safe: the size
+ * of a page is set before any block on it is handed out and cleared
+ * once they are all free again, so it cannot change while someone
+ * holds a block.
  *
- * Each pageref page contains 256 pagerefs, which can manage up to
- * 256 * 4K = 1M of kernel heap.
+ * The debugging modes want to see every allocation and free on the
+ * pages, so they turn the magazines off.
  */
 
-#define NPAGEREFS_PER_PAGE (PAGE_SIZE / sizeof(struct pageref))
-
-struct pagerefpage {
-	struct pageref refs[NPAGEREFS_PER_PAGE];
+struct magazine {
+	struct freelist *mag_blocks;	/* the free blocks */
+	unsigned mag_count;		/* how many there are */
+	unsigned mag_hits;		/* kmallocs and kfrees done here */
+	unsigned mag_refills;		/* batches from the pages */
+	unsigned mag_drains;		/* batches to the pages */
 };
 
-/*
- * This structure holds a pointer to a pageref page and also its
- * bitmap of free entries.
- */
+static struct magazine magazines[MAXCPUS][NSIZES];
 
-#define INUSE_WORDS (NPAGEREFS_PER_PAGE / 32)
+#if defined(SLOW) || defined(GUARDS) || defined(LABELS)
+#define USE_MAGAZINES 0
+#else
+#define USE_MAGAZINES 1
+#endif
 
-struct kheap_root {
-	struct pagerefpage *page;
-	uint32_t pagerefs_inuse[INUSE_WORDS];
-	unsigned numinuse;
-};
+////////////////////////////////////////
 
 /*
- * It would be better to make this dynamically sizeable. However,
- * since we only actually run on System/161 and System/161 is
- * specifically limited to 16M of RAM, we'll just adopt that as a
- * static size limit.
- *
- * FUTURE: it would be better to pick this number based on the RAM
- * size we find at boot time.
+ * The pageref of every physical page, indexed by page number. Set up
+ * by kmalloc_bootstrap, with memory stolen at boot: 16 bytes per 4K
+ * page, so the heap can grow to all of memory.
  */
+static struct pageref *pagerefs;
+static unsigned npagerefs;
 
-#define NUM_PAGEREFPAGES 16
-#define TOTAL_PAGEREFS (NUM_PAGEREFPAGES * NPAGEREFS_PER_PAGE)
-
-static struct kheap_root kheaproots[NUM_PAGEREFPAGES];
+#define PR_INUSE(pr)	((pr)->pageaddr_and_blocktype != 0)
 
 /*
- * Allocate a page to hold pagerefs.
+ * Get the pageref for the kernel page at PAGEADDR.
  */
 static
-void
-allocpagerefpage(struct kheap_root *root)
+inline
+struct pageref *
+pageref_of(vaddr_t pageaddr)
 {
-	vaddr_t va;
-
-	KASSERT(root->page == NULL);
-
-	/*
-	 * We release the spinlock while calling alloc_kpages. This
-	 * avoids deadlock if alloc_kpages needs to come back here.
-	 * Note that this means things can change behind our back...
-	 */
-	spinlock_release(&kmalloc_spinlock);
-	va = alloc_kpages(1);
-	spinlock_acquire(&kmalloc_spinlock);
-	if (va == 0) {
-		kprintf("kmalloc: Couldn't get a pageref page\n");
-		return;
-	}
-	KASSERT(va % PAGE_SIZE == 0);
+	paddr_t pa;
 
-	if (root->page != NULL) {
-		/* Oops, somebody else allocated it. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(va);
-		spinlock_acquire(&kmalloc_spinlock);
-		/* Once allocated it isn't ever freed. */
-		KASSERT(root->page != NULL);
-		return;
-	}
-
-	root->page = (struct pagerefpage *)va;
+	KASSERT(pageaddr >= MIPS_KSEG0 && pageaddr < MIPS_KSEG1);
+	pa = KVADDR_TO_PADDR(pageaddr);
+	KASSERT(pa / PAGE_SIZE < npagerefs);
+	return &pagerefs[pa / PAGE_SIZE];
 }
 
+////////////////////////////////////////
+
 /*
- * Allocate a pageref structure.
+ * The pages of each size that have free blocks are on a list; full
+ * pages are on no list, and go back on when a block is freed.
  */
+static struct pageref *sizebases[NSIZES];
+
 static
-struct pageref *
-allocpageref(void)
+void
+sizebase_add(struct pageref *pr, int blktype)
 {
-	unsigned i,j;
-	uint32_t k;
-	unsigned whichroot;
-	struct kheap_root *root;
-
-	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
-		root = &kheaproots[whichroot];
-		if (root->numinuse >= NPAGEREFS_PER_PAGE) {
-			continue;
-		}
-
-		/*
-		 * This should probably not be a linear search.
-		 */
-		for (i=0; i<INUSE_WORDS; i++) {
-			if (root->pagerefs_inuse[i]==0xffffffff) {
-				/* full */
-				continue;
-			}
-			for (k=1,j=0; k!=0; k<<=1,j++) {
-				if ((root->pagerefs_inuse[i] & k)==0) {
-					root->pagerefs_inuse[i] |= k;
-					root->numinuse++;
-					if (root->page == NULL) {
-						allocpagerefpage(root);
-					}
-					if (root->page == NULL) {
-						return NULL;
-					}
-					return &root->page->refs[i*32 + j];
-				}
-			}
-			KASSERT(0);
-		}
+	pr->next_samesize = sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->pprev_samesize = &pr->next_samesize;
 	}
-
-	/* ran out */
-	return NULL;
+	pr->pprev_samesize = &sizebases[blktype];
+	sizebases[blktype] = pr;
 }
 
-/*
- * Release a pageref structure.
- */
 static
 void
-freepageref(struct pageref *p)
+sizebase_remove(struct pageref *pr)
 {
-	size_t i, j;
-	uint32_t k;
-	unsigned whichroot;
-	struct kheap_root *root;
-	struct pagerefpage *page;
-
-	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
-		root = &kheaproots[whichroot];
-
-		page = root->page;
-		if (page == NULL) {
-			KASSERT(root->numinuse == 0);
-			continue;
-		}
-
-		j = p-page->refs;
-		/* note: j is unsigned, don't test < 0 */
-		if (j < NPAGEREFS_PER_PAGE) {
-			/* on this page */
-			i = j/32;
-			k = ((uint32_t)1) << (j%32);
-			KASSERT((root->pagerefs_inuse[i] & k) != 0);
-			root->pagerefs_inuse[i] &= ~k;
-			KASSERT(root->numinuse > 0);
-			root->numinuse--;
-			return;
-		}
+	KASSERT(pr->pprev_samesize != NULL);
+	*pr->pprev_samesize = pr->next_samesize;
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->pprev_samesize = pr->pprev_samesize;
 	}
-	/* pageref wasn't on any of the pages */
-	KASSERT(0);
+	pr->next_samesize = NULL;
+	pr->pprev_samesize = NULL;
 }
 
 ////////////////////////////////////////
 
-/*
- * Each pageref is on two linked lists: one list of pages of blocks of
- * that same size, and one of all blocks.
- */
-static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
-
-////////////////////////////////////////
-
 #ifdef GUARDS
 
 /* Space returned to the client is filled with GUARD_RETBYTE */
@@ -580,7 +517,7 @@ void
 checksubpages(void)
 {
 	struct pageref *pr;
-	int i;
+	unsigned i;
 	unsigned sc=0, ac=0;
 
 	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
@@ -588,15 +525,25 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < TOTAL_PAGEREFS);
+			KASSERT(PR_INUSE(pr));
+			KASSERT(PR_BLOCKTYPE(pr) == i);
+			KASSERT(pr->nfree > 0);
+			KASSERT(*pr->pprev_samesize == pr);
+			KASSERT(sc < npagerefs);
 			sc++;
 		}
 	}
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+	for (i=0; i<npagerefs; i++) {
+		pr = &pagerefs[i];
+		if (!PR_INUSE(pr)) {
+			continue;
+		}
 		checksubpage(pr);
-		KASSERT(ac < TOTAL_PAGEREFS);
-		ac++;
+		KASSERT((pr->nfree > 0) == (pr->pprev_samesize != NULL));
+		if (pr->nfree > 0) {
+			ac++;
+		}
 	}
 
 	KASSERT(sc==ac);
@@ -681,11 +628,12 @@ void
 dump_subpages(unsigned generation)
 {
 	struct pageref *pr;
-	int i;
+	unsigned i;
 
 	kprintf("Remaining allocations from generation %u:\n", generation);
-	for (i=0; i<NSIZES; i++) {
-		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+	for (i=0; i<npagerefs; i++) {
+		pr = &pagerefs[i];
+		if (PR_INUSE(pr)) {
 			dump_subpage(pr, generation);
 		}
 	}
@@ -739,6 +687,34 @@ kheap_dumpall(void)
 
 ////////////////////////////////////////
 
+/*
+ * Set up pagerefs[]. Must be called before the first kmalloc, while
+ * ram_stealmem still works.
+ */
+void
+kmalloc_bootstrap(void)
+{
+	paddr_t pa;
+	unsigned i, npages;
+
+	npagerefs = ram_getsize() / PAGE_SIZE;
+	npages = DIVROUNDUP(npagerefs * sizeof(struct pageref), PAGE_SIZE);
+	pa = ram_stealmem(npages);
+	if (pa == 0) {
+		panic("kmalloc_bootstrap: out of memory\n");
+	}
+	pagerefs = (struct pageref *)PADDR_TO_KVADDR(pa);
+	for (i = 0; i < npagerefs; i++) {
+		pagerefs[i].next_samesize = NULL;
+		pagerefs[i].pprev_samesize = NULL;
+		pagerefs[i].pageaddr_and_blocktype = 0;
+		pagerefs[i].freelist_offset = INVALID_OFFSET;
+		pagerefs[i].nfree = 0;
+	}
+}
+
+////////////////////////////////////////
+
 /*
  * Print the allocated/freed map of a single kernel heap page.
  */
@@ -801,49 +777,41 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	struct magazine *mag;
+	unsigned i, j;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		subpage_stats(pr);
+	for (i = 0; i < npagerefs; i++) {
+		pr = &pagerefs[i];
+		if (PR_INUSE(pr)) {
+			subpage_stats(pr);
+		}
 	}
 
 	spinlock_release(&kmalloc_spinlock);
-}
 
-////////////////////////////////////////
-
-/*
- * Remove a pageref from both lists that it's on.
- */
-static
-void
-remove_lists(struct pageref *pr, int blktype)
-{
-	struct pageref **guy;
-
-	KASSERT(blktype>=0 && blktype<NSIZES);
-
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
-	}
-
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
+	/* (racy, but it is only statistics) */
+	kprintf("Magazines (blocks held, hits, refills, drains):\n");
+	for (i = 0; i < cpu_count(); i++) {
+		for (j = 0; j < NSIZES; j++) {
+			mag = &magazines[i][j];
+			if (mag->mag_hits == 0 && mag->mag_count == 0) {
+				continue;
+			}
+			kprintf("cpu%u size %-4lu  %u/%u, %u, %u, %u\n", i,
+				(unsigned long) sizes[j], mag->mag_count,
+				magsizes[j], mag->mag_hits, mag->mag_refills,
+				mag->mag_drains);
 		}
 	}
 }
 
+////////////////////////////////////////
+
 /*
  * Given a requested client size, return the block type, that is, the
  * index into the sizes[] array for the block size to use.
@@ -867,18 +835,15 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Take a free block of type BLKTYPE off one of the pages, making a
+ * new page if none has any. Called with kmalloc_spinlock held and
+ * returns with it held, but may release it in between. Returns NULL
+ * if out of memory.
  */
 static
 void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+subpage_getblock(unsigned blktype)
 {
-	unsigned blktype;	// index into sizes[] that we're using
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
@@ -887,71 +852,45 @@ subpage_kmalloc(size_t sz
 
 	volatile int i;
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
-
-	spinlock_acquire(&kmalloc_spinlock);
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	checksubpages();
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+	pr = sizebases[blktype];
+	if (pr != NULL) {
 
 		/* check for corruption */
 		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		KASSERT(pr->nfree > 0);
 		checksubpage(pr);
 
-		if (pr->nfree > 0) {
+	doalloc: /* comes here after getting a whole fresh page */
 
-		doalloc: /* comes here after getting a whole fresh page */
-
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+		KASSERT(pr->freelist_offset < PAGE_SIZE);
+		prpage = PR_PAGEADDR(pr);
+		fla = prpage + pr->freelist_offset;
+		fl = (struct freelist *)fla;
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+		retptr = fl;
+		fl = fl->next;
+		pr->nfree--;
 
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
+		if (fl != NULL) {
+			KASSERT(pr->nfree > 0);
+			fla = (vaddr_t)fl;
+			KASSERT(fla - prpage < PAGE_SIZE);
+			pr->freelist_offset = fla - prpage;
+		}
+		else {
+			/* Page is full; off the list until a free */
+			KASSERT(pr->nfree == 0);
+			pr->freelist_offset = INVALID_OFFSET;
+			sizebase_remove(pr);
+		}
 
-			checksubpages();
+		checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
+		return retptr;
 	}
 
 	/*
@@ -968,6 +907,7 @@ subpage_kmalloc(size_t sz
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
@@ -977,14 +917,8 @@ subpage_kmalloc(size_t sz
 #endif
 	spinlock_acquire(&kmalloc_spinlock);
 
-	pr = allocpageref();
-	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
-		return NULL;
-	}
+	pr = pageref_of(prpage);
+	KASSERT(!PR_INUSE(pr));
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
@@ -1007,16 +941,168 @@ subpage_kmalloc(size_t sz
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
-
-	pr->next_all = allbase;
-	allbase = pr;
+	sizebase_add(pr, blktype);
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
+/*
+ * Find the heap page the block at PTRADDR is on, and its block type.
+ * Returns NULL if it is not on any of them. Call with kmalloc_spinlock
+ * held.
+ */
+static
+struct pageref *
+subpage_findpage(vaddr_t ptraddr, int *ret_blktype)
+{
+	struct pageref *pr;	// pageref for page we're freeing in
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	if (ptraddr < MIPS_KSEG0 || ptraddr >= MIPS_KSEG1) {
+		return NULL;
+	}
+	if (KVADDR_TO_PADDR(ptraddr) / PAGE_SIZE >= npagerefs) {
+		return NULL;
+	}
+	pr = pageref_of(ptraddr & PAGE_FRAME);
+	if (!PR_INUSE(pr)) {
+		return NULL;
+	}
+
+	/* check for corruption */
+	KASSERT(PR_PAGEADDR(pr) == (ptraddr & PAGE_FRAME));
+	KASSERT(PR_BLOCKTYPE(pr) < NSIZES);
+	checksubpage(pr);
+
+	*ret_blktype = PR_BLOCKTYPE(pr);
+	return pr;
+}
+
+/*
+ * Put the block at PTRADDR back on its page PR. If that makes the
+ * whole page free, take the page off the heap and return its address
+ * for the caller to free_kpages once it has released kmalloc_spinlock;
+ * otherwise return 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = ptraddr - prpage;
+
+	/* Check for proper positioning and alignment */
+	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n",
+		      (void *)ptraddr);
+	}
+
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
+
+	fla = prpage + offset;
+	fl = (struct freelist *)fla;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		/* Page was full; it has a free block again */
+		KASSERT(pr->nfree == 0);
+		fl->next = NULL;
+		sizebase_add(pr, blktype);
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
+
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
+			}
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
+#endif
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		sizebase_remove(pr);
+		pr->pageaddr_and_blocktype = 0;
+		pr->freelist_offset = INVALID_OFFSET;
+		pr->nfree = 0;
+		return prpage;
+	}
+	return 0;
+}
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation, from the pages.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
+
+	spinlock_acquire(&kmalloc_spinlock);
+	retptr = subpage_getblock(blktype);
+	spinlock_release(&kmalloc_spinlock);
+	if (retptr == NULL) {
+		return NULL;
+	}
+
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+	return retptr;
+}
+
 /*
  * Free a pointer previously returned from subpage_kmalloc. If the
  * pointer is not on any heap page we recognize, return -1.
@@ -1028,10 +1114,7 @@ subpage_kfree(void *ptr)
 	int blktype;		// index into sizes[] that we're using
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
-	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
-	vaddr_t offset;		// offset into page
+	vaddr_t prpage;		// page to give back, or 0
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
 #endif
@@ -1065,37 +1148,13 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = subpage_findpage(ptraddr, &blktype);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
-	offset = ptraddr - prpage;
-
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
-		panic("kfree: subpage free of invalid addr %p\n", ptr);
-	}
-
 #ifdef GUARDS
 	blocksize = sizes[blktype];
 	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
@@ -1108,79 +1167,215 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
+	prpage = subpage_putblock(pr, ptraddr);
 
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+	if (prpage != 0) {
+		free_kpages(prpage);
+	}
 
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
+#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
 
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
+	return 0;
+}
+
+////////////////////////////////////////
+
+#if USE_MAGAZINES
+/*
+ * Put the blocks on LIST back on their pages.
+ */
+static
+void
+subpage_putlist(struct freelist *list)
+{
+	vaddr_t freepages[MAXMAGSIZE / 2];
+	vaddr_t page;
+	struct freelist *next;
+	struct pageref *pr;
+	unsigned i, nfreepages;
+	int blktype;
+
+	nfreepages = 0;
+	spinlock_acquire(&kmalloc_spinlock);
+	for (; list != NULL; list = next) {
+		next = list->next;
+		pr = subpage_findpage((vaddr_t)list, &blktype);
+		KASSERT(pr != NULL);
+		/* (the link we just followed is not deadbeef) */
+		list->next = (struct freelist *)0xdeadbeef;
+		page = subpage_putblock(pr, (vaddr_t)list);
+		if (page != 0) {
+			/* at most one page per block drained */
+			KASSERT(nfreepages < ARRAYCOUNT(freepages));
+			freepages[nfreepages++] = page;
 		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
 	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
+	spinlock_release(&kmalloc_spinlock);
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
+	for (i = 0; i < nfreepages; i++) {
+		free_kpages(freepages[i]);
 	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Get a block of type BLKTYPE through the current cpu's magazine,
+ * refilling it from the pages if it is empty.
+ */
+static
+void *
+magazine_kmalloc(unsigned blktype)
+{
+	struct magazine *mag;
+	struct freelist *batch, *fl;
+	unsigned n;
+	int spl;
+
+	spl = splhigh();
+	mag = &magazines[curcpu->c_number][blktype];
+	if (mag->mag_count > 0) {
+		fl = mag->mag_blocks;
+		mag->mag_blocks = fl->next;
+		mag->mag_count--;
+		mag->mag_hits++;
+		splx(spl);
+		return fl;
 	}
+	splx(spl);
 
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	/*
+	 * Empty: get a batch from the pages. Making a new page may
+	 * sleep, so this is done with interrupts on; by the end we
+	 * may be on another cpu, or blocks may have been freed into
+	 * the magazine, so the batch goes into whatever magazine is
+	 * current then, as far as there is room.
+	 */
+	batch = NULL;
 	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
+	for (n = 0; n < magsizes[blktype] / 2; n++) {
+		fl = subpage_getblock(blktype);
+		if (fl == NULL) {
+			break;
+		}
+		fl->next = batch;
+		batch = fl;
+	}
 	spinlock_release(&kmalloc_spinlock);
-#endif
+	if (batch == NULL) {
+		return NULL;
+	}
 
-	return 0;
+	/* keep one for the caller */
+	fl = batch;
+	batch = batch->next;
+
+	spl = splhigh();
+	mag = &magazines[curcpu->c_number][blktype];
+	mag->mag_refills++;
+	while (batch != NULL && mag->mag_count < magsizes[blktype]) {
+		struct freelist *next = batch->next;
+
+		batch->next = mag->mag_blocks;
+		mag->mag_blocks = batch;
+		mag->mag_count++;
+		batch = next;
+	}
+	splx(spl);
+
+	if (batch != NULL) {
+		subpage_putlist(batch);
+	}
+	return fl;
+}
+
+/*
+ * Free PTR into the current cpu's magazine, sending half of it back
+ * to the pages if it is full. Returns false, doing nothing, if PTR is
+ * not on a heap page.
+ */
+static
+bool
+magazine_kfree(void *ptr)
+{
+	struct magazine *mag;
+	struct freelist *batch, *fl;
+	struct pageref *pr;
+	vaddr_t ptraddr;
+	unsigned blktype, n;
+	int spl;
+
+	ptraddr = (vaddr_t)ptr;
+	pr = pageref_of(ptraddr & PAGE_FRAME);
+	if (!PR_INUSE(pr)) {
+		return false;
+	}
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype < NSIZES);
+
+	/* Check for proper alignment */
+	if (ptraddr % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef(ptr, sizes[blktype]);
+
+	fl = ptr;
+	batch = NULL;
+
+	spl = splhigh();
+	mag = &magazines[curcpu->c_number][blktype];
+	if (mag->mag_count == magsizes[blktype]) {
+		for (n = 0; n < magsizes[blktype] / 2; n++) {
+			struct freelist *next = mag->mag_blocks->next;
+
+			mag->mag_blocks->next = batch;
+			batch = mag->mag_blocks;
+			mag->mag_blocks = next;
+		}
+		mag->mag_count -= n;
+		mag->mag_drains++;
+	}
+	/* (this should catch most double frees) */
+	KASSERT(fl != mag->mag_blocks);
+	fl->next = mag->mag_blocks;
+	mag->mag_blocks = fl;
+	mag->mag_count++;
+	mag->mag_hits++;
+	splx(spl);
+
+	if (batch != NULL) {
+		subpage_putlist(batch);
+	}
+	return true;
 }
+#endif /* USE_MAGAZINES */
 
 //
 ////////////////////////////////////////////////////////////
 
 /*
- * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
- * alloc_kpages depending on how big SZ is.
+ * Allocate a block of size SZ for the caller at LABEL. Redirect either
+ * to the magazines (or subpage_kmalloc) or alloc_kpages depending on
+ * how big SZ is.
  */
+static
 void *
-kmalloc(size_t sz)
+dokmalloc(size_t sz, vaddr_t label)
 {
 	size_t checksz;
-#ifdef LABELS
-	vaddr_t label;
-#endif
 
-#ifdef LABELS
-#ifdef __GNUC__
-	label = (vaddr_t)__builtin_return_address(0);
-#else
-#error "Don't know how to get return address with this compiler"
-#endif /* __GNUC__ */
-#endif /* LABELS */
+#ifndef LABELS
+	(void)label;
+#endif
 
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
@@ -1198,6 +1393,12 @@ kmalloc(size_t sz)
 		return (void *)address;
 	}
 
+#if USE_MAGAZINES
+	if (CURCPU_EXISTS()) {
+		return magazine_kmalloc(blocktype(sz));
+	}
+#endif
+
 #ifdef LABELS
 	return subpage_kmalloc(sz, label);
 #else
@@ -1205,6 +1406,28 @@ kmalloc(size_t sz)
 #endif
 }
 
+/*
+ * Allocate a block of size SZ, and tell the heap profiler who asked.
+ */
+void *
+kmalloc(size_t sz)
+{
+	vaddr_t label;
+	void *ptr;
+
+#ifdef __GNUC__
+	label = (vaddr_t)__builtin_return_address(0);
+#else
+#error "Don't know how to get return address with this compiler"
+#endif /* __GNUC__ */
+
+	ptr = dokmalloc(sz, label);
+	if (kheapprof_enabled) {
+		kheapprof_alloc(ptr, sz, label);
+	}
+	return ptr;
+}
+
 /*
  * Free a block previously returned from kmalloc.
  */
@@ -1216,7 +1439,21 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	if (kheapprof_enabled) {
+		kheapprof_free(ptr);
+	}
+#if USE_MAGAZINES
+	if (CURCPU_EXISTS()) {
+		if (!magazine_kfree(ptr)) {
+			/* not on a heap page, so a big allocation */
+			KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+			free_kpages((vaddr_t)ptr);
+		}
+		return;
+	}
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem_cache.h>
+
+/*
+ * Object caches.
+ *
+ * A slab is one page: a header at the start, then the objects. The
+ * slab of an object is found by rounding its address down to the
+ * page. The header ends with a stack of the indexes of the free
+ * objects, so nothing is kept in the objects themselves and they
+ * stay constructed while free.
+ *
+ * The slabs of a cache that have both free and allocated objects are
+ * on its partial list, and the all-free ones on its empty list; full
+ * slabs are on no list. Allocation takes from a partial slab if there
+ * is one, to pack objects into as few slabs as possible. A cache keeps
+ * at most KMEM_MAXEMPTY empty slabs, so a burst of frees does not tie
+ * up memory; beyond that, a slab that empties is destroyed and its
+ * page goes back to the VM system.
+ *
+ * Each cache has its own spinlock. The lock is dropped to create or
+ * destroy a slab, because that calls the constructor or destructor,
+ * which may call kmalloc.
+ */
+
+#define KMEM_ALIGN	8	/* object alignment */
+#define KMEM_MAXEMPTY	1	/* empty slabs kept per cache */
+
+struct kmem_slab {
+	struct kmem_slab *ks_next;
+	struct kmem_slab **ks_pprev;	/* what points to us */
+	struct kmem_cache *ks_cache;
+	unsigned ks_nfree;
+	uint16_t ks_free[];		/* indexes of free objects */
+};
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* object size */
+	size_t kc_stride;		/* object size, aligned */
+	size_t kc_firstoff;		/* offset of first object in slab */
+	unsigned kc_perslab;		/* objects per slab */
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+	struct kmem_cache *kc_next;	/* next on kmem_caches */
+
+	struct spinlock kc_lock;	/* protects everything below */
+	struct kmem_slab *kc_partial;	/* slabs with some objects free */
+	struct kmem_slab *kc_empty;	/* slabs with all objects free */
+	unsigned kc_nempty;
+
+	/* statistics */
+	unsigned kc_nslabs;		/* slabs now */
+	unsigned kc_inuse;		/* objects allocated now */
+	unsigned kc_maxinuse;		/* most objects allocated at once */
+	unsigned kc_allocs;		/* successful allocations */
+	unsigned kc_frees;		/* frees */
+	unsigned kc_fails;		/* failed allocations */
+	unsigned kc_grows;		/* slabs created */
+	unsigned kc_reaps;		/* slabs destroyed */
+};
+
+/* All the caches, newest first; caches are never destroyed. */
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+////////////////////////////////////////
+
+/*
+ * Slab list handling.
+ */
+static
+void
+slab_add(struct kmem_slab **head, struct kmem_slab *ks)
+{
+	ks->ks_next = *head;
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_pprev = &ks->ks_next;
+	}
+	ks->ks_pprev = head;
+	*head = ks;
+}
+
+static
+void
+slab_remove(struct kmem_slab *ks)
+{
+	KASSERT(ks->ks_pprev != NULL);
+	*ks->ks_pprev = ks->ks_next;
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_pprev = ks->ks_pprev;
+	}
+	ks->ks_next = NULL;
+	ks->ks_pprev = NULL;
+}
+
+/*
+ * Address of object INDEX of slab KS.
+ */
+static
+inline
+void *
+slab_obj(struct kmem_cache *kc, struct kmem_slab *ks, unsigned index)
+{
+	return (void *)((vaddr_t)ks + kc->kc_firstoff + index * kc->kc_stride);
+}
+
+/*
+ * Make a new slab for KC and construct its objects. Call without
+ * the cache lock. Returns NULL if out of memory, or if the constructor
+ * fails.
+ */
+static
+struct kmem_slab *
+slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t page;
+	unsigned i, j;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+	KASSERT(page % PAGE_SIZE == 0);
+
+	ks = (struct kmem_slab *)page;
+	ks->ks_next = NULL;
+	ks->ks_pprev = NULL;
+	ks->ks_cache = kc;
+
+	if (kc->kc_ctor != NULL) {
+		for (i = 0; i < kc->kc_perslab; i++) {
+			if (kc->kc_ctor(slab_obj(kc, ks, i)) != 0) {
+				for (j = 0; j < i; j++) {
+					if (kc->kc_dtor != NULL) {
+						kc->kc_dtor(slab_obj(kc, ks, j));
+					}
+				}
+				free_kpages(page);
+				return NULL;
+			}
+		}
+	}
+
+	/* hand out the objects in address order */
+	for (i = 0; i < kc->kc_perslab; i++) {
+		ks->ks_free[i] = kc->kc_perslab - 1 - i;
+	}
+	ks->ks_nfree = kc->kc_perslab;
+
+	return ks;
+}
+
+/*
+ * Destroy the objects of a slab that is all free and release its
+ * page. Call without the cache lock.
+ */
+static
+void
+slab_destroy(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	unsigned i;
+
+	KASSERT(ks->ks_cache == kc);
+	KASSERT(ks->ks_nfree == kc->kc_perslab);
+
+	if (kc->kc_dtor != NULL) {
+		for (i = 0; i < kc->kc_perslab; i++) {
+			kc->kc_dtor(slab_obj(kc, ks, i));
+		}
+	}
+	ks->ks_cache = NULL;
+	free_kpages((vaddr_t)ks);
+}
+
+////////////////////////////////////////
+
+/*
+ * Create a cache of objects of SIZE bytes.
+ */
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+	size_t hdrsize;
+	unsigned n;
+
+	KASSERT(size > 0);
+	KASSERT(ctor != NULL || dtor == NULL);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		panic("kmem_cache_create: %s: Out of memory\n", name);
+	}
+
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_stride = ROUNDUP(size, KMEM_ALIGN);
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+
+	/*
+	 * Fit as many objects as we can along with the header and its
+	 * free stack. The first guess ignores the alignment padding
+	 * after the header, so it may be one too many.
+	 */
+	hdrsize = sizeof(struct kmem_slab);
+	n = (PAGE_SIZE - hdrsize) / (kc->kc_stride + sizeof(uint16_t));
+	while (n > 0 && ROUNDUP(hdrsize + n * sizeof(uint16_t), KMEM_ALIGN)
+	       + n * kc->kc_stride > PAGE_SIZE) {
+		n--;
+	}
+	if (n == 0) {
+		panic("kmem_cache_create: %s: %zu-byte objects do not fit "
+		      "in a page\n", name, size);
+	}
+	kc->kc_perslab = n;
+	kc->kc_firstoff = ROUNDUP(hdrsize + n * sizeof(uint16_t), KMEM_ALIGN);
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = NULL;
+	kc->kc_empty = NULL;
+	kc->kc_nempty = 0;
+
+	kc->kc_nslabs = 0;
+	kc->kc_inuse = 0;
+	kc->kc_maxinuse = 0;
+	kc->kc_allocs = 0;
+	kc->kc_frees = 0;
+	kc->kc_fails = 0;
+	kc->kc_grows = 0;
+	kc->kc_reaps = 0;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_caches_lock);
+
+	return kc;
+}
+
+/*
+ * Allocate an object.
+ */
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+
+	ks = kc->kc_partial;
+	if (ks == NULL) {
+		ks = kc->kc_empty;
+		if (ks != NULL) {
+			slab_remove(ks);
+			kc->kc_nempty--;
+		}
+		else {
+			spinlock_release(&kc->kc_lock);
+			ks = slab_create(kc);
+			spinlock_acquire(&kc->kc_lock);
+			if (ks == NULL) {
+				kc->kc_fails++;
+				spinlock_release(&kc->kc_lock);
+				return NULL;
+			}
+			kc->kc_nslabs++;
+			kc->kc_grows++;
+		}
+		slab_add(&kc->kc_partial, ks);
+	}
+
+	KASSERT(ks->ks_cache == kc);
+	KASSERT(ks->ks_nfree > 0);
+	ks->ks_nfree--;
+	obj = slab_obj(kc, ks, ks->ks_free[ks->ks_nfree]);
+	if (ks->ks_nfree == 0) {
+		/* Full; off the list until something is freed */
+		slab_remove(ks);
+	}
+
+	kc->kc_allocs++;
+	kc->kc_inuse++;
+	if (kc->kc_inuse > kc->kc_maxinuse) {
+		kc->kc_maxinuse = kc->kc_inuse;
+	}
+
+	spinlock_release(&kc->kc_lock);
+	return obj;
+}
+
+/*
+ * Free an object back to its cache, in its constructed state.
+ */
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks;
+	vaddr_t offset;
+	unsigned index;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	ks = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	offset = (vaddr_t)obj - (vaddr_t)ks;
+	if (ks->ks_cache != kc || offset < kc->kc_firstoff ||
+	    (offset - kc->kc_firstoff) % kc->kc_stride != 0) {
+		panic("kmem_cache_free: %s: invalid object %p\n",
+		      kc->kc_name, obj);
+	}
+	index = (offset - kc->kc_firstoff) / kc->kc_stride;
+	KASSERT(index < kc->kc_perslab);
+
+	spinlock_acquire(&kc->kc_lock);
+
+	KASSERT(ks->ks_nfree < kc->kc_perslab);
+	if (ks->ks_nfree == 0) {
+		/* Was full; it has a free object again */
+		slab_add(&kc->kc_partial, ks);
+	}
+	ks->ks_free[ks->ks_nfree++] = index;
+
+	kc->kc_frees++;
+	kc->kc_inuse--;
+
+	if (ks->ks_nfree < kc->kc_perslab) {
+		ks = NULL;
+	}
+	else {
+		slab_remove(ks);
+		if (kc->kc_nempty < KMEM_MAXEMPTY) {
+			slab_add(&kc->kc_empty, ks);
+			kc->kc_nempty++;
+			ks = NULL;
+		}
+		else {
+			kc->kc_nslabs--;
+			kc->kc_reaps++;
+		}
+	}
+
+	spinlock_release(&kc->kc_lock);
+
+	if (ks != NULL) {
+		slab_destroy(kc, ks);
+	}
+}
+
+/*
+ * Print the statistics of all caches.
+ */
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+	unsigned nslabs, inuse, maxinuse, allocs, frees, fails, grows, reaps;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc = kmem_caches;
+	spinlock_release(&kmem_caches_lock);
+
+	kprintf("Object caches:\n");
+	kprintf("%-14s %5s %4s %5s %6s %6s %8s %8s %5s %5s %4s\n",
+		"name", "size", "/pg", "slabs", "inuse", "max",
+		"allocs", "frees", "grows", "reaps", "fail");
+
+	/* the list only grows at the head, so we can walk it unlocked */
+	for (; kc != NULL; kc = kc->kc_next) {
+		/* copy the counters so as not to print with the lock held */
+		spinlock_acquire(&kc->kc_lock);
+		nslabs = kc->kc_nslabs;
+		inuse = kc->kc_inuse;
+		maxinuse = kc->kc_maxinuse;
+		allocs = kc->kc_allocs;
+		frees = kc->kc_frees;
+		fails = kc->kc_fails;
+		grows = kc->kc_grows;
+		reaps = kc->kc_reaps;
+		spinlock_release(&kc->kc_lock);
+
+		kprintf("%-14s %5zu %4u %5u %6u %6u %8u %8u %5u %5u %4u\n",
+			kc->kc_name, kc->kc_size, kc->kc_perslab, nslabs,
+			inuse, maxinuse, allocs, frees, grows, reaps, fails);
+	}
+}
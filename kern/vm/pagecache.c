@@ -0,0 +1,668 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Page cache for mmap. See pagecache.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <stat.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <vm.h>
+
+/* Most mappings pagecache_evict unmaps at once (with one shootdown) */
+#define PC_EVICT_BATCH 8
+
+/*
+ * Protects vn_pagecache in every vnode and pc_refcount in every
+ * cache. Held across the final writeback so that a new cache for the
+ * same file cannot read it before the old one is written out.
+ *
+ * Lock order: pagecache_lock before pc_lock. Nobody waits for a
+ * pinned page while holding pc_lock; the fault handler holds a pin
+ * while it calls pagecache_setdirty, and the pageout code while it
+ * calls pagecache_evict.
+ */
+static struct lock *pagecache_lock;
+
+void
+pagecache_bootstrap(void)
+{
+	pagecache_lock = lock_create("pagecache");
+	if (pagecache_lock == NULL) {
+		panic("pagecache_bootstrap: out of memory\n");
+	}
+}
+
+static
+struct pagecache *
+pagecache_create(struct vnode *v)
+{
+	struct pagecache *pc;
+
+	pc = kmalloc(sizeof(struct pagecache));
+	if (pc == NULL) {
+		return NULL;
+	}
+	pc->pc_lock = lock_create("pagecache");
+	if (pc->pc_lock == NULL) {
+		kfree(pc);
+		return NULL;
+	}
+	pc->pc_vnode = v;
+	pc->pc_refcount = 1;
+	pc->pc_pages = NULL;
+	pc->pc_npages = 0;
+	pc->pc_gen = 0;
+	pc->pc_mappers = NULL;
+
+	if (v != NULL) {
+		VOP_INCREF(v);
+		/* before any page is read; see pagecache_refresh */
+		pc->pc_gen = vnode_getgen(v);
+	}
+	return pc;
+}
+
+/*
+ * Pin page IDX of PC and return it, or return 0 if it is not in the
+ * cache. Call with pc_lock held. The lock is dropped while waiting
+ * for the page, and the entry looked up again after, since the page
+ * may have been paged out meanwhile.
+ */
+static
+paddr_t
+pagecache_pinpage(struct pagecache *pc, unsigned idx)
+{
+	paddr_t pa;
+	bool pinned;
+
+	while (1) {
+		if (idx >= pc->pc_npages) {
+			return 0;
+		}
+		pa = pc->pc_pages[idx] & PAGE_FRAME;
+		if (pa == 0) {
+			return 0;
+		}
+		lock_release(pc->pc_lock);
+		pinned = coremap_pin(pa);
+		lock_acquire(pc->pc_lock);
+		if (pinned) {
+			if ((pc->pc_pages[idx] & PAGE_FRAME) == pa) {
+				return pa;
+			}
+			coremap_unpin(pa);
+		}
+	}
+}
+
+/*
+ * Read page IDX of the file into the page at KVA. A short read just
+ * means EOF; the rest is zeroed.
+ */
+static
+int
+pagecache_read(struct pagecache *pc, unsigned idx, void *kva)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, kva, PAGE_SIZE, (off_t)idx * PAGE_SIZE,
+		  UIO_READ);
+	result = VOP_READ(pc->pc_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	bzero((char *)kva + PAGE_SIZE - ku.uio_resid, ku.uio_resid);
+	return 0;
+}
+
+/*
+ * If the file has been written since the clean pages of PC were read,
+ * read them again. Each page is read aside first and then copied in,
+ * so processes running off it never see it half read.
+ */
+static
+int
+pagecache_refresh(struct pagecache *pc)
+{
+	unsigned gen, i;
+	paddr_t pa;
+	void *buf;
+	int result;
+
+	/*
+	 * Taken before reading, so a write meanwhile is seen next time.
+	 * That relies on the generation changing when a write is over
+	 * rather than when it starts (see vnode_write): otherwise we
+	 * could take the number of a write still under way, read what
+	 * was there before it and call that current.
+	 */
+	gen = vnode_getgen(pc->pc_vnode);
+
+	lock_acquire(pc->pc_lock);
+	if (pc->pc_gen == gen) {
+		lock_release(pc->pc_lock);
+		return 0;
+	}
+
+	buf = kmalloc(PAGE_SIZE);
+	if (buf == NULL) {
+		lock_release(pc->pc_lock);
+		return ENOMEM;
+	}
+
+	result = 0;
+	for (i = 0; i < pc->pc_npages && result == 0; i++) {
+		pa = pagecache_pinpage(pc, i);
+		if (pa == 0) {
+			continue;
+		}
+		if ((pc->pc_pages[i] & PCP_DIRTY) == 0) {
+			result = pagecache_read(pc, i, buf);
+			if (result == 0) {
+				memcpy((void *)PADDR_TO_KVADDR(pa), buf,
+				       PAGE_SIZE);
+			}
+		}
+		coremap_unpin(pa);
+	}
+	if (result == 0) {
+		pc->pc_gen = gen;
+	}
+	lock_release(pc->pc_lock);
+
+	kfree(buf);
+	return result;
+}
+
+int
+pagecache_attach(struct vnode *v, struct pagecache **ret)
+{
+	struct pagecache *pc;
+	int result;
+
+	if (v == NULL) {
+		pc = pagecache_create(NULL);
+		if (pc == NULL) {
+			return ENOMEM;
+		}
+		*ret = pc;
+		return 0;
+	}
+
+	lock_acquire(pagecache_lock);
+	pc = v->vn_pagecache;
+	if (pc != NULL) {
+		pc->pc_refcount++;
+	}
+	else {
+		pc = pagecache_create(v);
+		if (pc == NULL) {
+			lock_release(pagecache_lock);
+			return ENOMEM;
+		}
+		v->vn_pagecache = pc;
+	}
+	lock_release(pagecache_lock);
+
+	result = pagecache_refresh(pc);
+	if (result) {
+		pagecache_release(pc);
+		return result;
+	}
+
+	*ret = pc;
+	return 0;
+}
+
+void
+pagecache_incref(struct pagecache *pc)
+{
+	lock_acquire(pagecache_lock);
+	KASSERT(pc->pc_refcount > 0);
+	pc->pc_refcount++;
+	lock_release(pagecache_lock);
+}
+
+/*
+ * Write back the dirty pages of a file cache, up to the current end
+ * of the file. Call with pc_lock held.
+ */
+static
+int
+pagecache_writeback(struct pagecache *pc)
+{
+	struct stat st;
+	struct iovec iov;
+	struct uio ku;
+	off_t off;
+	size_t len;
+	unsigned i;
+	int result;
+
+	KASSERT(pc->pc_vnode != NULL);
+
+	result = VOP_STAT(pc->pc_vnode, &st);
+	if (result) {
+		return result;
+	}
+
+	for (i = 0; i < pc->pc_npages; i++) {
+		if ((pc->pc_pages[i] & PCP_DIRTY) == 0) {
+			continue;
+		}
+		off = (off_t)i * PAGE_SIZE;
+		if (off >= st.st_size) {
+			/* past EOF; mappings do not extend the file */
+			continue;
+		}
+		len = PAGE_SIZE;
+		if (st.st_size - off < PAGE_SIZE) {
+			len = st.st_size - off;
+		}
+
+		uio_kinit(&iov, &ku,
+			  (void *)PADDR_TO_KVADDR(pc->pc_pages[i] & PAGE_FRAME),
+			  len, off, UIO_WRITE);
+		result = VOP_WRITE(pc->pc_vnode, &ku);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+void
+pagecache_release(struct pagecache *pc)
+{
+	paddr_t pa;
+	unsigned i;
+	int result;
+
+	lock_acquire(pagecache_lock);
+	KASSERT(pc->pc_refcount > 0);
+	pc->pc_refcount--;
+	if (pc->pc_refcount > 0) {
+		lock_release(pagecache_lock);
+		return;
+	}
+
+	KASSERT(pc->pc_mappers == NULL);
+	if (pc->pc_vnode != NULL) {
+		lock_acquire(pc->pc_lock);
+		result = pagecache_writeback(pc);
+		lock_release(pc->pc_lock);
+		if (result) {
+			kprintf("pagecache: writeback failed: %s\n",
+				strerror(result));
+		}
+		KASSERT(pc->pc_vnode->vn_pagecache == pc);
+		pc->pc_vnode->vn_pagecache = NULL;
+	}
+	lock_release(pagecache_lock);
+
+	/*
+	 * Nobody else can get at the pages now, except the pageout
+	 * code, which may still be evicting one.
+	 */
+	lock_acquire(pc->pc_lock);
+	for (i = 0; i < pc->pc_npages; i++) {
+		pa = pagecache_pinpage(pc, i);
+		if (pa != 0) {
+			pc->pc_pages[i] = 0;
+			coremap_setcache(pa, NULL, 0);
+			vm_free_upage(pa);
+		}
+	}
+	lock_release(pc->pc_lock);
+
+	if (pc->pc_vnode != NULL) {
+		VOP_DECREF(pc->pc_vnode);
+	}
+	if (pc->pc_pages != NULL) {
+		kfree(pc->pc_pages);
+	}
+	lock_destroy(pc->pc_lock);
+	kfree(pc);
+}
+
+/*
+ * Make room for index IDX in pc_pages. Call with pc_lock held.
+ */
+static
+int
+pagecache_grow(struct pagecache *pc, unsigned idx)
+{
+	paddr_t *newpages;
+	unsigned newsize, i;
+
+	if (idx < pc->pc_npages) {
+		return 0;
+	}
+
+	newsize = pc->pc_npages * 2;
+	if (newsize <= idx) {
+		newsize = idx + 1;
+	}
+	newpages = kmalloc(newsize * sizeof(paddr_t));
+	if (newpages == NULL) {
+		return ENOMEM;
+	}
+	for (i = 0; i < newsize; i++) {
+		newpages[i] = i < pc->pc_npages ? pc->pc_pages[i] : 0;
+	}
+	if (pc->pc_pages != NULL) {
+		kfree(pc->pc_pages);
+	}
+	pc->pc_pages = newpages;
+	pc->pc_npages = newsize;
+	return 0;
+}
+
+/*
+ * Fill a new (zeroed) cache page from the file, if any.
+ */
+static
+int
+pagecache_fill(struct pagecache *pc, unsigned idx, paddr_t pa)
+{
+	if (pc->pc_vnode == NULL) {
+		return 0;
+	}
+	return pagecache_read(pc, idx, (void *)PADDR_TO_KVADDR(pa));
+}
+
+int
+pagecache_getpage(struct pagecache *pc, unsigned idx, paddr_t *ret,
+		  bool *readin)
+{
+	paddr_t pa;
+	int result;
+
+	*readin = false;
+
+	lock_acquire(pc->pc_lock);
+
+	result = pagecache_grow(pc, idx);
+	if (result) {
+		lock_release(pc->pc_lock);
+		return result;
+	}
+
+	pa = pagecache_pinpage(pc, idx);
+	if (pa == 0) {
+		/* comes back pinned, with the cache's reference */
+		pa = vm_alloc_zeroed_upage();
+		if (pa == 0) {
+			lock_release(pc->pc_lock);
+			return ENOMEM;
+		}
+		result = pagecache_fill(pc, idx, pa);
+		if (result) {
+			vm_free_upage(pa);
+			lock_release(pc->pc_lock);
+			return result;
+		}
+		pc->pc_pages[idx] = pa;
+		*readin = pc->pc_vnode != NULL;
+	}
+	/* no owner: paged out through the cache, see pagecache_evict */
+	coremap_setcache(pa, pc, idx);
+	lock_release(pc->pc_lock);
+
+	coremap_incref(pa);
+	*ret = pa;
+	return 0;
+}
+
+bool
+pagecache_peekpage(struct pagecache *pc, unsigned idx, paddr_t *ret)
+{
+	paddr_t pa;
+
+	lock_acquire(pc->pc_lock);
+	pa = pagecache_pinpage(pc, idx);
+	if (pa != 0) {
+		/* marks it referenced */
+		coremap_setcache(pa, pc, idx);
+	}
+	lock_release(pc->pc_lock);
+
+	if (pa == 0) {
+		return false;
+	}
+	coremap_incref(pa);
+	*ret = pa;
+	return true;
+}
+
+void
+pagecache_setdirty(struct pagecache *pc, unsigned idx)
+{
+	lock_acquire(pc->pc_lock);
+	KASSERT(idx < pc->pc_npages && pc->pc_pages[idx] != 0);
+	pc->pc_pages[idx] |= PCP_DIRTY;
+	lock_release(pc->pc_lock);
+}
+
+bool
+pagecache_isdirty(struct pagecache *pc, unsigned idx)
+{
+	bool dirty;
+
+	lock_acquire(pc->pc_lock);
+	KASSERT(idx < pc->pc_npages && pc->pc_pages[idx] != 0);
+	dirty = (pc->pc_pages[idx] & PCP_DIRTY) != 0;
+	lock_release(pc->pc_lock);
+
+	return dirty;
+}
+
+void
+pagecache_addmapper(struct pagecache *pc, struct region *rg)
+{
+	KASSERT(rg->rg_cache == pc);
+
+	lock_acquire(pc->pc_lock);
+	rg->rg_cachenext = pc->pc_mappers;
+	pc->pc_mappers = rg;
+	lock_release(pc->pc_lock);
+}
+
+void
+pagecache_delmapper(struct pagecache *pc, struct region *rg)
+{
+	struct region **p;
+
+	lock_acquire(pc->pc_lock);
+	for (p = &pc->pc_mappers; *p != rg; p = &(*p)->rg_cachenext) {
+		KASSERT(*p != NULL);
+	}
+	*p = rg->rg_cachenext;
+	rg->rg_cachenext = NULL;
+	lock_release(pc->pc_lock);
+}
+
+/*
+ * Find the page table entry of RG that maps page IDX of its cache,
+ * if that is PADDR, and the address it maps it at. Call with pc_lock
+ * held and PADDR pinned, which keeps the entry from changing. The
+ * region itself may be in the middle of being cut down by munmap, so
+ * what it claims to map is only a hint; the entry decides.
+ */
+static
+pte_t *
+pagecache_findpte(struct region *rg, unsigned idx, paddr_t paddr,
+		  vaddr_t *vaddr)
+{
+	pte_t *pte;
+	off_t off;
+
+	off = (off_t)idx * PAGE_SIZE - rg->rg_offset;
+	if (off < 0 || off >= (off_t)rg->rg_npages * PAGE_SIZE) {
+		return NULL;
+	}
+	*vaddr = rg->rg_vbase + off;
+	pte = pt_lookup(rg->rg_as->as_pt, *vaddr, false);
+	if (pte == NULL ||
+	    (*pte & (PTE_FRAME | PTE_VALID)) != (paddr | PTE_VALID)) {
+		return NULL;
+	}
+	return pte;
+}
+
+/*
+ * Unmap the pinned page PADDR at the N entries in PTES, and drop their
+ * references to it. Their PTE_TLBVALID bits are already clear, so the
+ * fast refill path cannot load them again behind the shootdown's back.
+ */
+static
+void
+pagecache_unmap(paddr_t paddr, struct tlbinval *inval, pte_t **ptes,
+		unsigned n)
+{
+	unsigned i;
+
+	if (n == 0) {
+		return;
+	}
+	vm_tlb_shootdown(inval, n);
+	for (i = 0; i < n; i++) {
+		*ptes[i] = 0;
+		as_rss_adjust(inval[i].ti_as, -1);
+		coremap_decref(paddr);
+	}
+}
+
+/*
+ * Called by the pageout code for a page of PC the clock picked. Clean
+ * pages read back in from the file (or as zeros, if anonymous), so
+ * they need not go to swap; but the page has to come out of every page
+ * table mapping it first. A mapping with PTE_TLBVALID set has been
+ * used since the clock last came by (see pagetable.h); like
+ * coremap_pickvictim for private pages, take that away and give the
+ * page another round.
+ *
+ * We may be called from an allocation made by whoever holds pc_lock
+ * (pagecache_getpage, say), so only try for it.
+ */
+bool
+pagecache_evict(struct pagecache *pc, unsigned idx, paddr_t paddr)
+{
+	struct tlbinval inval[PC_EVICT_BATCH];
+	pte_t *ptes[PC_EVICT_BATCH];
+	struct region *rg;
+	pte_t *pte;
+	vaddr_t va;
+	bool referenced;
+	unsigned n, i;
+
+	if (lock_do_i_hold(pc->pc_lock) || lock_tryacquire(pc->pc_lock)) {
+		coremap_unpin(paddr);
+		return false;
+	}
+
+	/* Dirty pages have PCP_DIRTY set and do not compare equal. */
+	if (idx >= pc->pc_npages || pc->pc_pages[idx] != paddr) {
+		goto refuse;
+	}
+
+	referenced = false;
+	for (rg = pc->pc_mappers; rg != NULL; rg = rg->rg_cachenext) {
+		pte = pagecache_findpte(rg, idx, paddr, &va);
+		if (pte == NULL) {
+			continue;
+		}
+		if (*pte & PTE_LOCKED) {
+			goto refuse;
+		}
+		if (*pte & PTE_TLBVALID) {
+			*pte &= ~(pte_t)(PTE_TLBVALID | PTE_TLBDIRTY);
+			referenced = true;
+		}
+	}
+	if (referenced) {
+		goto refuse;
+	}
+
+	n = 0;
+	for (rg = pc->pc_mappers; rg != NULL; rg = rg->rg_cachenext) {
+		pte = pagecache_findpte(rg, idx, paddr, &va);
+		if (pte == NULL) {
+			continue;
+		}
+		for (i = 0; i < n && ptes[i] != pte; i++) {
+			/* already have it, if munmap confused us */
+		}
+		if (i < n) {
+			continue;
+		}
+		ptes[n] = pte;
+		inval[n].ti_as = rg->rg_as;
+		inval[n].ti_vaddr = va;
+		n++;
+		if (n == PC_EVICT_BATCH) {
+			pagecache_unmap(paddr, inval, ptes, n);
+			n = 0;
+		}
+	}
+	pagecache_unmap(paddr, inval, ptes, n);
+
+	if (coremap_refcount(paddr) != 1) {
+		/*
+		 * Mapped somewhere we do not know of yet: by fork, in a
+		 * region not yet added to the mappers. The mappings we
+		 * took away just fault back in.
+		 */
+		goto refuse;
+	}
+
+	pc->pc_pages[idx] = 0;
+	lock_release(pc->pc_lock);
+
+	coremap_setcache(paddr, NULL, 0);
+	vm_free_upage(paddr);
+	return true;
+
+ refuse:
+	lock_release(pc->pc_lock);
+	coremap_unpin(paddr);
+	return false;
+}
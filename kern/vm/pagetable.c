@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Two-level page table. See pagetable.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <pagetable.h>
+#include <coremap.h>
+
+/*
+ * Create an empty page table: all directory slots are empty.
+ */
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+
+	for (i = 0; i < PT_L1_SIZE; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+
+	return pt;
+}
+
+/*
+ * Free every second-level table and the directory itself.
+ */
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	KASSERT(pt != NULL);
+
+	for (i = 0; i < PT_L1_SIZE; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+/*
+ * Find the page table entry for VADDR, allocating the second-level
+ * table if CREATE is set and it does not exist yet.
+ */
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *l2;
+	unsigned i;
+
+	KASSERT(pt != NULL);
+
+	l2 = pt->pt_dir[PT_L1_INDEX(vaddr)];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PT_L2_SIZE * sizeof(pte_t));
+		if (l2 == NULL) {
+			return NULL;
+		}
+		for (i = 0; i < PT_L2_SIZE; i++) {
+			l2[i] = 0;
+		}
+		pt->pt_dir[PT_L1_INDEX(vaddr)] = l2;
+	}
+
+	return &l2[PT_L2_INDEX(vaddr)];
+}
+
+/*
+ * Pin the frame mapped by PTE. The pageout code may be evicting the
+ * page at the same time, in which case coremap_pin waits for it and
+ * fails, and by then the entry no longer holds that frame; so look
+ * again until we either pin the frame the entry still maps, or find
+ * the entry not valid.
+ */
+paddr_t
+pt_pin(pte_t *pte)
+{
+	pte_t entry;
+	paddr_t paddr;
+
+	while (1) {
+		entry = *pte;
+		if ((entry & PTE_VALID) == 0) {
+			return 0;
+		}
+		paddr = entry & PTE_FRAME;
+		if (!coremap_pin(paddr)) {
+			continue;
+		}
+		if (*pte == entry) {
+			return paddr;
+		}
+		coremap_unpin(paddr);
+	}
+}
@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Swap and pageout. See swap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <stat.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <thread.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <swap.h>
+#include <vm.h>
+
+/* A PTE has room for 20 bits of slot number */
+#define SWAP_MAXSLOTS (1U << 20)
+
+/* Most pages swap_evict takes at once (and shoots down together) */
+#define SWAP_EVICT_BATCH 8
+
+/* Most victims swap_evict lets go of unevicted before giving up */
+#define SWAP_EVICT_SKIPS 8
+
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+static struct vnode *swap_vnode;	/* swap device, or NULL */
+static struct bitmap *swap_map;		/* slots in use */
+static unsigned swap_nslots;		/* slots on the device */
+static unsigned swap_nused;		/* slots in use */
+static unsigned swap_highwater;		/* pageout stops here */
+
+/* Statistics */
+static unsigned swap_pageouts;		/* pages written to swap */
+static unsigned swap_pageins;		/* pages read from swap */
+static unsigned swap_evictions;		/* pages evicted (clean or not) */
+
+/*
+ * The pageout thread: sleep until memory gets low, then evict pages
+ * until it is comfortable again. If nothing can be evicted (all pages
+ * shared or pinned, or swap full), wait for the next allocation
+ * rather than spinning.
+ */
+static
+void
+pageout_thread(void *data1, unsigned long data2)
+{
+	bool stalled = false;
+	unsigned nfree;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		coremap_pageout_wait(stalled);
+		stalled = false;
+		while ((nfree = coremap_freepages()) < swap_highwater) {
+			if (swap_evict(swap_highwater - nfree)) {
+				stalled = true;
+				break;
+			}
+		}
+	}
+}
+
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	unsigned lowwater;
+	int result;
+
+	result = vfs_swapon(SWAP_DEVICE, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: VOP_STAT on %s: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots > SWAP_MAXSLOTS) {
+		swap_nslots = SWAP_MAXSLOTS;
+	}
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is empty; running without swap\n",
+			SWAP_DEVICE);
+		VOP_DECREF(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: out of memory for the slot bitmap\n");
+	}
+
+	/* Keep about 3-6% of memory free, and never less than 4 pages. */
+	lowwater = coremap_totalpages() / 32;
+	if (lowwater < 4) {
+		lowwater = 4;
+	}
+	swap_highwater = 2 * lowwater;
+
+	result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+	if (result) {
+		panic("swap: cannot start pageout thread: %s\n",
+		      strerror(result));
+	}
+	coremap_setwatermark(lowwater);
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	if (swap_vnode == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_nused++;
+	}
+	spinlock_release(&swap_lock);
+
+	return result;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_nused--;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Move one page between memory and swap.
+ */
+static
+int
+swap_io(unsigned slot, paddr_t paddr, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+
+	spinlock_acquire(&swap_lock);
+	if (rw == UIO_READ) {
+		swap_pageins++;
+	}
+	else {
+		swap_pageouts++;
+	}
+	spinlock_release(&swap_lock);
+
+	return 0;
+}
+
+int
+swap_read(unsigned slot, paddr_t paddr)
+{
+	return swap_io(slot, paddr, UIO_READ);
+}
+
+int
+swap_write(unsigned slot, paddr_t paddr)
+{
+	return swap_io(slot, paddr, UIO_WRITE);
+}
+
+/*
+ * Write out one victim of AS picked and shot down by swap_evict, and
+ * free it. On failure the page is just unpinned; it will fault back
+ * in.
+ */
+static
+int
+swap_evict_page(struct addrspace *as, pte_t *pte, paddr_t paddr)
+{
+	unsigned slot;
+	int result;
+
+	if (coremap_isdirty(paddr)) {
+		result = swap_alloc(&slot);
+		if (result) {
+			coremap_unpin(paddr);
+			return result;
+		}
+		result = swap_write(slot, paddr);
+		if (result) {
+			swap_free(slot);
+			coremap_unpin(paddr);
+			return result;
+		}
+	}
+	else {
+		/* Unmodified since it was read in: the copy in swap is good. */
+		slot = coremap_getslot(paddr);
+		KASSERT(slot != SWAP_NOSLOT);
+	}
+
+	*pte = PTE_MKSWAPPED(slot);
+	as_rss_adjust(as, -1);
+
+	/* The slot now belongs to the page table entry. */
+	coremap_setslot(paddr, SWAP_NOSLOT);
+	coremap_free(paddr);
+
+	return 0;
+}
+
+/*
+ * Page out up to MAX pages. The victims come back from the clock
+ * pinned, so their owners cannot map them, copy them or free them
+ * until we are done; any of those wait in coremap_pin and then find
+ * the page table entry pointing to swap. The translations are shot
+ * down (all in one go) before writing so that the owners cannot
+ * change the pages while they are being written; and before that
+ * the entries lose PTE_TLBVALID, so that the fast refill path does
+ * not put them back behind the shootdown's back.
+ *
+ * Page cache pages are handed to the cache instead, which unmaps them
+ * from everywhere and frees them if they are clean; those need no
+ * swap. The cache may also decline (see pagecache_evict), in which
+ * case we look for another victim, a few times.
+ */
+int
+swap_evict(unsigned max)
+{
+	struct tlbinval inval[SWAP_EVICT_BATCH];
+	paddr_t paddrs[SWAP_EVICT_BATCH];
+	pte_t *ptes[SWAP_EVICT_BATCH];
+	struct pagecache *pc;
+	unsigned n, i, idx, nevicted, nskipped;
+	int result, err;
+
+	if (max > SWAP_EVICT_BATCH) {
+		max = SWAP_EVICT_BATCH;
+	}
+
+	n = 0;
+	nevicted = 0;
+	nskipped = 0;
+	while (n + nevicted < max && nskipped < SWAP_EVICT_SKIPS) {
+		paddrs[n] = coremap_pickvictim(&inval[n].ti_as,
+					       &inval[n].ti_vaddr, &pc, &idx);
+		if (paddrs[n] == 0) {
+			break;
+		}
+		if (pc != NULL) {
+			if (pagecache_evict(pc, idx, paddrs[n])) {
+				nevicted++;
+			}
+			else {
+				nskipped++;
+			}
+			continue;
+		}
+		if (swap_vnode == NULL) {
+			/* nowhere to put it */
+			coremap_unpin(paddrs[n]);
+			nskipped++;
+			continue;
+		}
+		ptes[n] = pt_lookup(inval[n].ti_as->as_pt, inval[n].ti_vaddr,
+				    false);
+		KASSERT(ptes[n] != NULL);
+		KASSERT((*ptes[n] & (PTE_FRAME | PTE_VALID | PTE_LOCKED)) ==
+			(paddrs[n] | PTE_VALID));
+		/* Keep the fast refill path from loading it again. */
+		*ptes[n] &= ~(pte_t)(PTE_TLBVALID | PTE_TLBDIRTY);
+		n++;
+	}
+	if (n == 0 && nevicted == 0) {
+		return ENOMEM;
+	}
+
+	if (n > 0) {
+		vm_tlb_shootdown(inval, n);
+	}
+
+	err = 0;
+	for (i = 0; i < n; i++) {
+		result = swap_evict_page(inval[i].ti_as, ptes[i], paddrs[i]);
+		if (result) {
+			err = result;
+		}
+		else {
+			nevicted++;
+		}
+	}
+
+	spinlock_acquire(&swap_lock);
+	swap_evictions += nevicted;
+	spinlock_release(&swap_lock);
+
+	return nevicted > 0 ? 0 : err;
+}
+
+void
+swap_printstats(void)
+{
+	unsigned nused, pageouts, pageins, evictions;
+
+	if (swap_vnode == NULL) {
+		kprintf("swap: none\n");
+		return;
+	}
+
+	spinlock_acquire(&swap_lock);
+	nused = swap_nused;
+	pageouts = swap_pageouts;
+	pageins = swap_pageins;
+	evictions = swap_evictions;
+	spinlock_release(&swap_lock);
+
+	kprintf("swap: %u of %u pages used\n", nused, swap_nslots);
+	kprintf("swap: %u evictions, %u pageouts, %u pageins\n",
+		evictions, pageouts, pageins);
+}
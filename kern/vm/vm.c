@@ -0,0 +1,833 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Demand-paged VM system.
+ *
+ * Nothing is loaded or zeroed up front: as_define_region only
+ * records the layout of the address space, and load_elf only tells
+ * the address space where each segment lives in the executable.
+ * Pages are materialized by vm_fault the first time they are
+ * touched, either by reading the right piece of the executable or by
+ * zero-filling an anonymous page. Under memory pressure pages are
+ * paged out to swap (see swap.c) and paged back in here as well.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vnode.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <swap.h>
+#include <vm.h>
+
+/*
+ * How many pages to page out looking for room for a multi-page
+ * kernel allocation, per page wanted, before giving up. Evicting
+ * user pages frees them in clock order, not contiguously, so there
+ * is no guarantee this will ever help.
+ */
+#define VM_EVICT_PER_KPAGE 16
+
+/* Pages read ahead in regions advised MADV_SEQUENTIAL */
+#define VM_READAHEAD 8
+
+/*
+ * Fault-around window, in pages (see vm_faultaround); 1 turns it
+ * off. Settable from the kernel menu, up to VM_FAULTAROUND_MAX.
+ */
+#define VM_FAULTAROUND_DEFAULT 8
+#define VM_FAULTAROUND_MAX     32
+static unsigned vm_faultaround_pages = VM_FAULTAROUND_DEFAULT;
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	vm_tlb_bootstrap();
+	pagecache_bootstrap();
+	swap_bootstrap();
+}
+
+/*
+ * Check if we're in a context that can sleep. Filling a page may
+ * require reading from the executable, so the fault path and the
+ * address space operations must never be called while holding a
+ * spinlock or from an interrupt handler.
+ */
+static
+void
+vm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/*
+ * Allocate from the coremap, paging out user pages to make room if
+ * necessary (at most MAXEVICT of them).
+ */
+static
+paddr_t
+vm_getpages(unsigned npages, unsigned state, unsigned maxevict)
+{
+	paddr_t pa;
+	unsigned i;
+
+	vm_can_sleep();
+
+	pa = coremap_alloc(npages, state);
+	for (i = 0; pa == 0 && i < maxevict; i++) {
+		if (swap_evict(1)) {
+			break;
+		}
+		pa = coremap_alloc(npages, state);
+	}
+	return pa;
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	pa = vm_getpages(npages, CME_KERNEL,
+			 npages == 1 ? (unsigned)-1 : npages * VM_EVICT_PER_KPAGE);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+/* Allocate/free one physical page for a user address space */
+paddr_t
+vm_alloc_upage(void)
+{
+	return vm_getpages(1, CME_USER, (unsigned)-1);
+}
+
+paddr_t
+vm_alloc_zeroed_upage(void)
+{
+	paddr_t pa;
+
+	vm_can_sleep();
+
+	pa = coremap_alloc_zeroed();
+	while (pa == 0 && swap_evict(1) == 0) {
+		pa = coremap_alloc_zeroed();
+	}
+	return pa;
+}
+
+void
+vm_free_upage(paddr_t paddr)
+{
+	coremap_free(paddr);
+}
+
+/*
+ * Background work for an idle cpu: top up the pre-zeroed page pool,
+ * one page per call so the cpu can go back and look for threads to
+ * run in between.
+ */
+bool
+vm_idle(void)
+{
+	return coremap_zero_one();
+}
+
+/*
+ * Print VM statistics (from the kernel menu).
+ */
+void
+vm_printstats(void)
+{
+	struct coremap_zerostats zs;
+	struct cpu *c;
+	unsigned i, misses = 0, evictions = 0, rollovers = 0;
+	unsigned sent = 0, recv = 0, pages = 0, flushes = 0;
+	unsigned fa = 0, fapages = 0, famapped = 0, farefaults = 0;
+	unsigned fast = 0;
+
+	kprintf("vm: %u of %u pages free\n",
+		coremap_freepages(), coremap_totalpages());
+
+	coremap_zerostats(&zs);
+	kprintf("vm: zero pool: %u of %u pages, %u hits, %u misses, "
+		"%u zeroed while idle\n", zs.zs_pool, zs.zs_target,
+		zs.zs_hits, zs.zs_misses, zs.zs_idlezeroed);
+	coremap_printstats();
+
+	for (i = 0; i < cpu_count(); i++) {
+		c = cpu_get(i);
+		kprintf("vm: cpu%u: %u TLB misses (%u more on the fast path), "
+			"%u evictions, %u ASID rollovers\n",
+			c->c_number, c->c_tlb_misses,
+			vm_tlb_fastrefills(c->c_number), c->c_tlb_evictions,
+			c->c_asid_rollovers);
+		kprintf("vm: cpu%u: %u shootdowns sent, %u received "
+			"(%u pages, %u full flushes)\n",
+			c->c_number, c->c_shootdowns_sent,
+			c->c_shootdowns_recv, c->c_shootdown_pages,
+			c->c_shootdown_flushes);
+		misses += c->c_tlb_misses;
+		fast += vm_tlb_fastrefills(c->c_number);
+		evictions += c->c_tlb_evictions;
+		rollovers += c->c_asid_rollovers;
+		sent += c->c_shootdowns_sent;
+		recv += c->c_shootdowns_recv;
+		pages += c->c_shootdown_pages;
+		flushes += c->c_shootdown_flushes;
+		fa += c->c_faultarounds;
+		fapages += c->c_faultaround_pages;
+		famapped += c->c_faultaround_mapped;
+		farefaults += c->c_faultaround_refaults;
+	}
+	kprintf("vm: total: %u TLB misses (%u more on the fast path), "
+		"%u evictions, %u ASID rollovers\n", misses, fast, evictions,
+		rollovers);
+	kprintf("vm: total: %u shootdowns sent, %u received "
+		"(%u pages, %u full flushes)\n", sent, recv, pages, flushes);
+	kprintf("vm: fault-around (%u pages): %u faults, %u TLB entries "
+		"preloaded (%u pages mapped from page caches)\n",
+		vm_faultaround_pages, fa, fapages, famapped);
+	kprintf("vm: fault-around: %u TLB misses on preloaded pages "
+		"(%u%% of preloads wasted at most)\n", farefaults,
+		fapages == 0 ? 0 : farefaults * 100 / fapages);
+
+	swap_printstats();
+}
+
+/*
+ * Intersect the page at VADDR with the file data of the region,
+ * giving [*START, *END). Returns false if the page has no file data
+ * at all (anonymous memory or bss) and is simply zero-filled.
+ */
+static
+bool
+vm_file_range(struct region *rg, vaddr_t vaddr, vaddr_t *start, vaddr_t *end)
+{
+	if (rg->rg_vnode == NULL || rg->rg_filesize == 0) {
+		return false;
+	}
+
+	*start = vaddr;
+	if (*start < rg->rg_vaddr) {
+		*start = rg->rg_vaddr;
+	}
+	*end = vaddr + PAGE_SIZE;
+	if (*end > rg->rg_vaddr + rg->rg_filesize) {
+		*end = rg->rg_vaddr + rg->rg_filesize;
+	}
+
+	return *start < *end;
+}
+
+/*
+ * Fill the page at VADDR (physical page PADDR) with its initial
+ * contents: the part of the page covered by the region's file data,
+ * [START, END), is read from the vnode, the rest is zeroed.
+ */
+static
+int
+vm_fill_page(struct region *rg, vaddr_t vaddr, paddr_t paddr,
+	     vaddr_t start, vaddr_t end)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t kvaddr;
+	int result;
+
+	kvaddr = PADDR_TO_KVADDR(paddr);
+
+	/* Zero what comes before and after the file data... */
+	bzero((void *)kvaddr, start - vaddr);
+	bzero((void *)(kvaddr + (end - vaddr)), vaddr + PAGE_SIZE - end);
+
+	/* ...and read the file data in between. */
+	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n",
+	      (unsigned long) (end - start), (unsigned long) start);
+
+	uio_kinit(&iov, &ku, (void *)(kvaddr + (start - vaddr)), end - start,
+		  rg->rg_offset + (start - rg->rg_vaddr), UIO_READ);
+	result = VOP_READ(rg->rg_vnode, &ku);
+	if (result) {
+		return result;
+	}
+
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+
+	return 0;
+}
+
+/*
+ * Give the address space its own copy of the page at *PADDR, which
+ * it shares copy-on-write with others, and drop its reference to the
+ * shared one. Both pages are pinned: on entry the shared one, on
+ * return (in *PADDR) the copy.
+ */
+static
+int
+vm_copy_on_write(pte_t *pte, paddr_t *paddr)
+{
+	paddr_t oldpaddr, newpaddr;
+
+	oldpaddr = *paddr;
+
+	newpaddr = vm_alloc_upage();
+	if (newpaddr == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newpaddr),
+		(const void *)PADDR_TO_KVADDR(oldpaddr),
+		PAGE_SIZE);
+
+	/* (same flags: a locked page stays locked) */
+	*pte = newpaddr | (*pte & ~PTE_FRAME);
+	vm_free_upage(oldpaddr);
+
+	*paddr = newpaddr;
+	return 0;
+}
+
+/*
+ * Read a paged-out page back in from swap. The page keeps its swap
+ * slot, so if it is not modified before it is paged out again it
+ * need not be written. Returns the new page, pinned, in *PADDR.
+ */
+static
+int
+vm_swapin(pte_t *pte, paddr_t *paddr)
+{
+	unsigned slot;
+	paddr_t pa;
+	int result;
+
+	slot = PTE_SLOT(*pte);
+
+	pa = vm_alloc_upage();
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	result = swap_read(slot, pa);
+	if (result) {
+		vm_free_upage(pa);
+		return result;
+	}
+	coremap_setclean(pa, slot);
+
+	*pte = pa | PTE_VALID;
+	*paddr = pa;
+	return 0;
+}
+
+/*
+ * Whether the pinned page PADDR, page IDX of RG's page cache if it
+ * has one, with REFCOUNT references, may be mapped writable.
+ *
+ * Shared pages are mapped read-only so that the first write comes
+ * back to vm_fault as VM_FAULT_READONLY, and so are clean ones so
+ * that we find out when they stop being clean. Pages of a shared
+ * mapping are always shared with the page cache; there it is the
+ * cache that keeps track of what is clean.
+ */
+static
+bool
+vm_writeable(struct region *rg, unsigned idx, paddr_t paddr,
+	     unsigned refcount)
+{
+	if ((rg->rg_perm & REGION_WRITE) == 0) {
+		return false;
+	}
+	if (rg->rg_shared) {
+		return pagecache_isdirty(rg->rg_cache, idx);
+	}
+	return refcount == 1 && coremap_isdirty(paddr);
+}
+
+/*
+ * Record in the entry PTE of a pinned page that it has been loaded
+ * into the TLB, WRITEABLE or not, so that the fast refill path may
+ * load it again the same way (see pagetable.h).
+ */
+static
+void
+vm_settlb(pte_t *pte, bool writeable)
+{
+	*pte &= ~(pte_t)(PTE_TLBVALID | PTE_TLBDIRTY);
+	*pte |= PTE_TLBVALID;
+	if (writeable) {
+		*pte |= PTE_TLBDIRTY;
+	}
+}
+
+/*
+ * Get the page at VADDR, in region RG of AS, resident and pinned for
+ * an access of type FAULTTYPE, which has been checked against the
+ * region's permissions: read it in or copy it on write as needed.
+ * Hands back the page in *PADDR, whether it may be mapped writable
+ * in *WRITEABLE, and whether it had to be mapped in (a page fault
+ * proper, rather than just a TLB miss) in *MAPPED.
+ */
+static
+int
+vm_getpage(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	   int faulttype, paddr_t *retpaddr, bool *writeable, bool *mapped)
+{
+	pte_t *pte;
+	paddr_t paddr;
+	vaddr_t start, end;
+	unsigned refcount, slot, idx;
+	bool readin;
+	int result;
+
+	idx = 0;
+	if (rg->rg_cache != NULL) {
+		idx = (rg->rg_offset + (vaddr - rg->rg_vbase)) / PAGE_SIZE;
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	/*
+	 * Get the page resident and pinned, noting for the statistics
+	 * whether that took I/O.
+	 */
+	paddr = pt_pin(pte);
+	*mapped = paddr == 0;
+	readin = false;
+	if (paddr == 0 && (*pte & PTE_SWAPPED)) {
+		result = vm_swapin(pte, &paddr);
+		if (result) {
+			return result;
+		}
+		readin = true;
+	}
+	else if (paddr == 0 && rg->rg_cache != NULL) {
+		/* First touch of a mapped page: get it from the cache. */
+		result = pagecache_getpage(rg->rg_cache, idx, &paddr, &readin);
+		if (result) {
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+	}
+	else if (paddr == 0 && vm_file_range(rg, vaddr, &start, &end)) {
+		/* First touch: get a page and read it in. */
+		paddr = vm_alloc_upage();
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		result = vm_fill_page(rg, vaddr, paddr, start, end);
+		if (result) {
+			vm_free_upage(paddr);
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+		readin = true;
+	}
+	else if (paddr == 0) {
+		/* First touch of anonymous memory or bss. */
+		paddr = vm_alloc_zeroed_upage();
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		*pte = paddr | PTE_VALID;
+	}
+
+	if (*mapped) {
+		as_rss_adjust(as, 1);
+		if (readin) {
+			curproc->p_usage.pu_majflt++;
+		}
+		else {
+			curproc->p_usage.pu_minflt++;
+		}
+		if (as->as_rss > curproc->p_usage.pu_maxrss) {
+			curproc->p_usage.pu_maxrss = as->as_rss;
+		}
+	}
+
+	if (faulttype != VM_FAULT_READ && rg->rg_shared) {
+		/* Write to a shared mapping: goes to the cached page. */
+		pagecache_setdirty(rg->rg_cache, idx);
+	}
+	else if (faulttype != VM_FAULT_READ) {
+		if (coremap_refcount(paddr) > 1) {
+			/* First write to a page shared with a fork relative. */
+			result = vm_copy_on_write(pte, &paddr);
+			if (result) {
+				coremap_unpin(paddr);
+				return result;
+			}
+			curproc->p_usage.pu_cowcopies++;
+		}
+		/* Any copy in swap is about to become stale. */
+		slot = coremap_setdirty(paddr);
+		if (slot != SWAP_NOSLOT) {
+			swap_free(slot);
+		}
+	}
+
+	/*
+	 * A page only we map is ours to page out (it may have been
+	 * shared when we got it, so claim it every time), unless it
+	 * is locked.
+	 */
+	refcount = coremap_refcount(paddr);
+	if (refcount == 1) {
+		if (*pte & PTE_LOCKED) {
+			coremap_setowner(paddr, NULL, 0);
+		}
+		else {
+			coremap_setowner(paddr, as, vaddr);
+		}
+	}
+
+	*writeable = vm_writeable(rg, idx, paddr, refcount);
+	*retpaddr = paddr;
+	return 0;
+}
+
+/*
+ * Read ahead in a region declared sequential with madvise: after a
+ * page fault at VADDR, bring in the next VM_READAHEAD pages of the
+ * region as well, so that a sequential scan takes one page fault per
+ * VM_READAHEAD + 1 pages. This is not worth paging anything out for,
+ * so it stops when memory is short.
+ */
+static
+void
+vm_readahead(struct addrspace *as, struct region *rg, vaddr_t vaddr)
+{
+	vaddr_t va, end;
+	paddr_t paddr;
+	pte_t *pte;
+	bool writeable, mapped;
+	unsigned i;
+
+	end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	va = vaddr + PAGE_SIZE;
+	for (i = 0; i < VM_READAHEAD && va < end; i++, va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte != NULL && (*pte & PTE_VALID)) {
+			continue;
+		}
+		if (coremap_freepages() <= VM_READAHEAD) {
+			break;
+		}
+		if (vm_getpage(as, rg, va, VM_FAULT_READ, &paddr,
+			       &writeable, &mapped)) {
+			break;
+		}
+		coremap_unpin(paddr);
+	}
+}
+
+/*
+ * Fault-around: after a TLB miss at VADDR, also load the TLB with the
+ * other resident pages of the region in the aligned window of
+ * vm_faultaround_pages pages around it, mapping pages that are
+ * already in the region's page cache on the way. A scan through
+ * resident memory then takes one TLB miss per window instead of one
+ * per page. Nothing is read in or allocated (that is read-ahead's
+ * job), and pages that are busy are waited for like in vm_fault.
+ *
+ * Preloaded entries are marked PTE_PRELOADED. A later TLB miss on
+ * such a page means the preload did not (or not for long) save a
+ * trap: the entry was pushed out of the TLB before the page was used
+ * or soon after. Those misses are counted against the prediction.
+ */
+static
+void
+vm_faultaround(struct addrspace *as, struct region *rg, vaddr_t vaddr)
+{
+	vaddr_t start, end, rgend, va;
+	pte_t *pte;
+	paddr_t paddr;
+	unsigned window, idx, nmapped;
+	bool writeable;
+	int spl;
+
+	window = vm_faultaround_pages;
+	if (window <= 1) {
+		return;
+	}
+
+	start = vaddr - ((vaddr / PAGE_SIZE) % window) * PAGE_SIZE;
+	end = start + window * PAGE_SIZE;
+	rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	if (start < rg->rg_vbase) {
+		start = rg->rg_vbase;
+	}
+	if (end > rgend) {
+		end = rgend;
+	}
+
+	nmapped = 0;
+	for (va = start; va < end; va += PAGE_SIZE) {
+		if (va == vaddr) {
+			continue;
+		}
+		idx = 0;
+		if (rg->rg_cache != NULL) {
+			idx = (rg->rg_offset + (va - rg->rg_vbase)) / PAGE_SIZE;
+		}
+
+		pte = pt_lookup(as->as_pt, va, rg->rg_cache != NULL);
+		if (pte == NULL) {
+			continue;
+		}
+		paddr = pt_pin(pte);
+		if (paddr == 0) {
+			/* Only pages in the cache can be had for free. */
+			if (rg->rg_cache == NULL || (*pte & PTE_SWAPPED) ||
+			    !pagecache_peekpage(rg->rg_cache, idx, &paddr)) {
+				continue;
+			}
+			*pte = paddr | PTE_VALID;
+			as_rss_adjust(as, 1);
+			if (as->as_rss > curproc->p_usage.pu_maxrss) {
+				curproc->p_usage.pu_maxrss = as->as_rss;
+			}
+			nmapped++;
+		}
+
+		writeable = vm_writeable(rg, idx, paddr,
+					 coremap_refcount(paddr));
+		vm_settlb(pte, writeable);
+		*pte |= PTE_PRELOADED;
+		vm_tlb_preload(va, paddr, writeable);
+		coremap_unpin(paddr);
+	}
+
+	spl = splhigh();
+	curcpu->c_faultarounds++;
+	curcpu->c_faultaround_mapped += nmapped;
+	splx(spl);
+}
+
+void
+vm_set_faultaround(unsigned npages)
+{
+	if (npages < 1) {
+		npages = 1;
+	}
+	if (npages > VM_FAULTAROUND_MAX) {
+		npages = VM_FAULTAROUND_MAX;
+	}
+	vm_faultaround_pages = npages;
+}
+
+/*
+ * Fault in the page at VADDR of AS without mapping it in the TLB,
+ * and if LOCK lock it in memory (see as_mlock).
+ */
+int
+vm_prefault(struct addrspace *as, vaddr_t vaddr, bool lock)
+{
+	struct region *rg;
+	pte_t *pte;
+	paddr_t paddr;
+	bool writeable, mapped;
+	int faulttype, result;
+
+	vm_can_sleep();
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL || rg->rg_perm == 0) {
+		return EFAULT;
+	}
+
+	/*
+	 * A locked private page had better not need copying on its
+	 * first write; do that now.
+	 */
+	faulttype = VM_FAULT_READ;
+	if (lock && (rg->rg_perm & REGION_WRITE) && !rg->rg_shared) {
+		faulttype = VM_FAULT_WRITE;
+	}
+
+	result = vm_getpage(as, rg, vaddr, faulttype, &paddr,
+			    &writeable, &mapped);
+	if (result) {
+		return result;
+	}
+
+	if (faulttype == VM_FAULT_WRITE) {
+		/* It may have been copied: drop any entry for the old one. */
+		vm_tlb_invalidate(vaddr);
+	}
+
+	if (lock) {
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		KASSERT(pte != NULL && (*pte & PTE_FRAME) == paddr);
+		if ((*pte & PTE_LOCKED) == 0) {
+			*pte |= PTE_LOCKED;
+			as->as_nlocked++;
+			/* no owner: the pageout code will leave it alone */
+			coremap_setowner(paddr, NULL, 0);
+		}
+	}
+	coremap_unpin(paddr);
+
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	paddr_t paddr;
+	bool writeable, mapped;
+	int result, spl;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		/*
+		 * Write to a page loaded without write permission:
+		 * either text, or a page shared copy-on-write.
+		 */
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	vm_can_sleep();
+
+	rg = as_find_region(as, faultaddress);
+	if (rg == NULL) {
+		/* Maybe just below the stack: grow it. */
+		rg = as_grow_stack(as, faultaddress);
+		if (rg == NULL) {
+			return EFAULT;
+		}
+	}
+	if (rg->rg_perm == 0) {
+		/* mmap with PROT_NONE */
+		return EFAULT;
+	}
+	if (faulttype != VM_FAULT_READ && (rg->rg_perm & REGION_WRITE) == 0) {
+		return EFAULT;
+	}
+
+	result = vm_getpage(as, rg, faultaddress, faulttype, &paddr,
+			    &writeable, &mapped);
+	if (result) {
+		return result;
+	}
+
+	/* The page is pinned, so its entry is ours to change. */
+	pte = pt_lookup(as->as_pt, faultaddress, false);
+	KASSERT(pte != NULL && (*pte & PTE_FRAME) == paddr);
+	if (*pte & PTE_PRELOADED) {
+		*pte &= ~(pte_t)PTE_PRELOADED;
+		if (faulttype != VM_FAULT_READONLY) {
+			/* (a write to a read-only preload did use it) */
+			spl = splhigh();
+			curcpu->c_faultaround_refaults++;
+			splx(spl);
+		}
+	}
+
+	vm_settlb(pte, writeable);
+	result = vm_tlb_load(faultaddress, paddr, writeable);
+	coremap_unpin(paddr);
+	curproc->p_usage.pu_tlbrefill++;
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Read ahead first, so that fault-around finds the pages read
+	 * ahead resident and preloads them too.
+	 */
+	if (mapped && rg->rg_advice == MADV_SEQUENTIAL) {
+		vm_readahead(as, rg, faultaddress);
+	}
+	if (faulttype != VM_FAULT_READONLY && rg->rg_advice != MADV_RANDOM) {
+		vm_faultaround(as, rg, faultaddress);
+	}
+
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+/*
+ * khprof - kernel heap profile.
+ * Usage: khprof [on|off|reset]
+ *
+ * With no argument, prints the profile: allocations, frees and what
+ * is still outstanding, by size class and by call site, with the
+ * sites holding the most memory first. (Look the call sites up in
+ * the kernel's symbol table.) With an argument, passes it to the
+ * profiler: "on" starts a fresh profile, "off" stops profiling, and
+ * "reset" clears the counts.
+ *
+ * This is just a front end to the kheap: device.
+ */
+
+#define KHEAPDEV "kheap:"
+
+static
+void
+print(void)
+{
+	char buf[1024];
+	int fd, len;
+
+	fd = open(KHEAPDEV, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", KHEAPDEV);
+	}
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		if (write(STDOUT_FILENO, buf, len) != len) {
+			err(1, "stdout");
+		}
+	}
+	if (len < 0) {
+		err(1, "%s", KHEAPDEV);
+	}
+	close(fd);
+}
+
+static
+void
+command(const char *cmd)
+{
+	int fd;
+	ssize_t len;
+
+	fd = open(KHEAPDEV, O_WRONLY);
+	if (fd < 0) {
+		err(1, "%s", KHEAPDEV);
+	}
+	len = write(fd, cmd, strlen(cmd));
+	if (len < 0) {
+		err(1, "%s: %s", KHEAPDEV, cmd);
+	}
+	close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc == 1) {
+		print();
+	}
+	else if (argc == 2) {
+		command(argv[1]);
+	}
+	else {
+		errx(1, "Usage: khprof [on|off|reset]");
+	}
+	return 0;
+}
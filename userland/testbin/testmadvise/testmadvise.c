@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * testmadvise.c
+ *
+ * 	Test program for the madvise, mincore, mlock and munlock syscalls.
+ *	Usage: testmadvise
+ *
+ *	Maps anonymous memory and checks with mincore that pages become
+ *	resident when touched, when advised MADV_WILLNEED and when
+ *	locked, and stop being resident when advised MADV_DONTNEED
+ *	(after which they read as zero again). Also checks the errors
+ *	for unmapped ranges and bad arguments.
+ */
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE 4096
+#define NPAGES 8
+#define SIZE (NPAGES * PAGE)
+
+static char vec[NPAGES];
+
+/*
+ * Check that mincore reports exactly the pages in WANT (one bit per
+ * page) resident.
+ */
+static
+void
+checkcore(const char *what, char *mem, unsigned want)
+{
+    int i;
+
+    if (mincore(mem, SIZE, vec)) {
+        err(1, "%s: mincore", what);
+    }
+    for (i = 0; i < NPAGES; i++) {
+        if ((vec[i] & 1) != ((want >> i) & 1)) {
+            errx(1, "%s: page %d %sresident", what, i,
+                 vec[i] & 1 ? "" : "not ");
+        }
+    }
+}
+
+static
+void
+experr(const char *what, int result, int wanterr)
+{
+    if (result == 0) {
+        errx(1, "%s: succeeded", what);
+    }
+    if (errno != wanterr) {
+        err(1, "%s: wrong error", what);
+    }
+}
+
+int
+main(void)
+{
+    char *mem;
+    int i;
+
+    mem = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON,
+               -1, 0);
+    if (mem == MAP_FAILED) {
+        err(1, "mmap");
+    }
+
+    /* nothing is there until touched */
+    checkcore("fresh mapping", mem, 0);
+    mem[0] = 1;
+    mem[3 * PAGE] = 1;
+    checkcore("after touching", mem, 0x09);
+
+    /* WILLNEED brings the pages in */
+    if (madvise(mem + 4 * PAGE, 2 * PAGE, MADV_WILLNEED)) {
+        err(1, "madvise WILLNEED");
+    }
+    checkcore("after WILLNEED", mem, 0x39);
+
+    /* DONTNEED throws them away; they come back zero-filled */
+    if (madvise(mem, 4 * PAGE, MADV_DONTNEED)) {
+        err(1, "madvise DONTNEED");
+    }
+    checkcore("after DONTNEED", mem, 0x30);
+    if (mem[0] != 0 || mem[3 * PAGE] != 0) {
+        errx(1, "page not zero after DONTNEED");
+    }
+
+    /* a sequential scan reads ahead */
+    if (madvise(mem, SIZE, MADV_SEQUENTIAL)) {
+        err(1, "madvise SEQUENTIAL");
+    }
+    if (madvise(mem, SIZE, MADV_DONTNEED)) {
+        err(1, "madvise DONTNEED");
+    }
+    mem[0] = 2;
+    if (mincore(mem, SIZE, vec)) {
+        err(1, "mincore");
+    }
+    if ((vec[1] & 1) == 0) {
+        errx(1, "no read-ahead after MADV_SEQUENTIAL");
+    }
+    if (madvise(mem, SIZE, MADV_NORMAL)) {
+        err(1, "madvise NORMAL");
+    }
+    printf("madvise ok\n");
+
+    /* locked pages are resident and cannot be thrown away */
+    if (madvise(mem, SIZE, MADV_DONTNEED)) {
+        err(1, "madvise DONTNEED");
+    }
+    if (mlock(mem + 2 * PAGE, 2 * PAGE)) {
+        err(1, "mlock");
+    }
+    checkcore("after mlock", mem, 0x0c);
+    experr("DONTNEED on locked pages",
+           madvise(mem, SIZE, MADV_DONTNEED), EINVAL);
+    for (i = 2 * PAGE; i < 4 * PAGE; i++) {
+        mem[i] = 3;
+    }
+    if (munlock(mem + 2 * PAGE, 2 * PAGE)) {
+        err(1, "munlock");
+    }
+    if (madvise(mem, SIZE, MADV_DONTNEED)) {
+        err(1, "madvise DONTNEED after munlock");
+    }
+    checkcore("after munlock", mem, 0);
+    printf("mlock ok\n");
+
+    /* errors */
+    experr("madvise with bad advice", madvise(mem, PAGE, 99), EINVAL);
+    experr("madvise unaligned", madvise(mem + 1, PAGE, MADV_NORMAL), EINVAL);
+    experr("mincore with bad vector", mincore(mem, SIZE, NULL), EFAULT);
+    if (munmap(mem, SIZE)) {
+        err(1, "munmap");
+    }
+    experr("mincore on unmapped memory", mincore(mem, SIZE, vec), ENOMEM);
+    experr("mlock on unmapped memory", mlock(mem, SIZE), ENOMEM);
+    printf("errors ok\n");
+
+    printf("testmadvise: passed\n");
+    return 0;
+}
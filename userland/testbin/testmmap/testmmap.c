@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * testmmap.c
+ *
+ * 	Test program for mmap and munmap syscalls.
+ *	Usage: testmmap [file]
+ *
+ *	Writes a file, maps it shared and private, checks that writes
+ *	through the shared mapping reach the file and writes through the
+ *	private one do not, then tries anonymous memory (also across
+ *	fork for a shared anonymous mapping).
+ */
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define PAGE 4096
+#define NPAGES 3
+#define SIZE (NPAGES * PAGE)
+
+static char buf[SIZE];
+
+static
+char
+pattern(int i)
+{
+    return 'a' + (i * 7) % 26;
+}
+
+static
+void
+makefile(const char *name)
+{
+    int fd, i;
+
+    for (i = 0; i < SIZE; i++) {
+        buf[i] = pattern(i);
+    }
+    fd = open(name, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        err(1, "%s: open for write", name);
+    }
+    if (write(fd, buf, SIZE) != SIZE) {
+        err(1, "%s: write", name);
+    }
+    close(fd);
+}
+
+static
+void
+readfile(const char *name)
+{
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        err(1, "%s: open for read", name);
+    }
+    if (read(fd, buf, SIZE) != SIZE) {
+        err(1, "%s: read", name);
+    }
+    close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *name = "testmmap.dat";
+    char *shared, *private, *anon;
+    int fd, i, status;
+    pid_t pid;
+
+    if (argc > 1) {
+        name = argv[1];
+    }
+
+    makefile(name);
+
+    fd = open(name, O_RDWR);
+    if (fd < 0) {
+        err(1, "%s: open", name);
+    }
+    shared = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED) {
+        err(1, "mmap shared");
+    }
+    private = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (private == MAP_FAILED) {
+        err(1, "mmap private");
+    }
+    close(fd);
+
+    /* both see the file */
+    for (i = 0; i < SIZE; i++) {
+        if (shared[i] != pattern(i) || private[i] != pattern(i)) {
+            errx(1, "mapping differs from file at byte %d", i);
+        }
+    }
+
+    /* private writes stay private, shared ones are seen by everybody */
+    private[0] = 'X';
+    shared[PAGE] = 'Y';
+    if (shared[0] != pattern(0)) {
+        errx(1, "private write seen through shared mapping");
+    }
+    if (private[PAGE] != 'Y') {
+        errx(1, "shared write not seen through private mapping");
+    }
+
+    if (munmap(private, SIZE) || munmap(shared, SIZE)) {
+        err(1, "munmap");
+    }
+
+    readfile(name);
+    if (buf[0] != pattern(0) || buf[PAGE] != 'Y') {
+        errx(1, "file contents wrong after munmap");
+    }
+    printf("file mappings ok\n");
+
+    /* the open mode limits what can be mapped */
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        err(1, "%s: open for read", name);
+    }
+    if (mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        != MAP_FAILED || errno != EACCES) {
+        errx(1, "shared writable mapping of a read-only file allowed");
+    }
+    private = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (private == MAP_FAILED) {
+        err(1, "mmap private of a read-only file");
+    }
+    munmap(private, SIZE);
+    close(fd);
+    fd = open(name, O_WRONLY);
+    if (fd < 0) {
+        err(1, "%s: open for write", name);
+    }
+    if (mmap(NULL, SIZE, PROT_READ, MAP_SHARED, fd, 0) != MAP_FAILED ||
+        errno != EACCES) {
+        errx(1, "mapping of a write-only file allowed");
+    }
+    close(fd);
+    printf("open modes ok\n");
+
+    /* private anonymous memory is zero-filled */
+    anon = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON,
+                -1, 0);
+    if (anon == MAP_FAILED) {
+        err(1, "mmap anonymous");
+    }
+    for (i = 0; i < SIZE; i++) {
+        if (anon[i] != 0) {
+            errx(1, "anonymous memory not zero at byte %d", i);
+        }
+    }
+    /* unmapping the middle page leaves the others */
+    anon[0] = anon[2 * PAGE] = 1;
+    if (munmap(anon + PAGE, PAGE)) {
+        err(1, "munmap middle page");
+    }
+    if (anon[0] != 1 || anon[2 * PAGE] != 1) {
+        errx(1, "partial munmap lost data");
+    }
+    munmap(anon, SIZE);
+
+    /* shared anonymous memory is shared with the child */
+    anon = mmap(NULL, PAGE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON,
+                -1, 0);
+    if (anon == MAP_FAILED) {
+        err(1, "mmap shared anonymous");
+    }
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        anon[0] = 42;
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (anon[0] != 42) {
+        errx(1, "child's write to shared anonymous memory not seen");
+    }
+    printf("anonymous mappings ok\n");
+
+    remove(name);
+    printf("testmmap: passed\n");
+    return 0;
+}
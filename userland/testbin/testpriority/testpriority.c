@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * testpriority.c
+ *
+ * 	Test program for getpriority and setpriority syscalls.
+ *	Usage: testpriority
+ *
+ *	Sets its own priority and checks it reads back, with out of range
+ *	values clamped, then checks that a child inherits the priority
+ *	across fork, that the parent can look at and change the child's,
+ *	and that the child cannot change the parent's.
+ */
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+static
+void
+expect(int who, int prio)
+{
+    int got;
+
+    errno = 0;
+    got = getpriority(PRIO_PROCESS, who);
+    if (errno != 0) {
+        err(1, "getpriority %d", who);
+    }
+    if (got != prio) {
+        errx(1, "priority of %d is %d, expected %d", who, got, prio);
+    }
+}
+
+static
+void
+set(int who, int prio)
+{
+    if (setpriority(PRIO_PROCESS, who, prio)) {
+        err(1, "setpriority %d %d", who, prio);
+    }
+}
+
+int
+main()
+{
+    int status;
+    pid_t pid;
+
+    expect(0, 0);
+
+    set(0, 10);
+    expect(0, 10);
+    expect(getpid(), 10);
+
+    set(0, PRIO_MAX + 100);
+    expect(0, PRIO_MAX);
+    set(0, PRIO_MIN - 100);
+    expect(0, PRIO_MIN);
+
+    set(0, 5);
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        /* inherited from the parent */
+        expect(0, 5);
+        /* not allowed to renice the parent */
+        if (setpriority(PRIO_PROCESS, getppid(), PRIO_MIN) == 0 ||
+            errno != EPERM) {
+            warnx("renicing the parent did not fail with EPERM");
+            _exit(1);
+        }
+        /* wait for the parent to renice us */
+        while (getpriority(PRIO_PROCESS, 0) != PRIO_MAX) {
+            /* spin */
+        }
+        _exit(0);
+    }
+    expect(pid, 5);
+    set(pid, PRIO_MAX);
+    if (waitpid(pid, &status, 0) != pid) {
+        err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "child failed");
+    }
+
+    if (getpriority(PRIO_PGRP, 0) != -1 || errno != EINVAL) {
+        errx(1, "getpriority with PRIO_PGRP did not fail with EINVAL");
+    }
+    if (setpriority(PRIO_USER, 0, 0) == 0 || errno != EINVAL) {
+        errx(1, "setpriority with PRIO_USER did not fail with EINVAL");
+    }
+    if (getpriority(PRIO_PROCESS, 12345) != -1 || errno != ESRCH) {
+        errx(1, "getpriority of a bad pid did not fail with ESRCH");
+    }
+
+    printf("testpriority: passed\n");
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * testrusage.c
+ *
+ * 	Test program for getrusage and wait4 syscalls.
+ *	Usage: testrusage
+ *
+ *	Touches some memory and checks that the faults and resident pages
+ *	show up in getrusage, then has a child do the same and checks
+ *	what wait4 and getrusage(RUSAGE_CHILDREN) report for it.
+ */
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define PAGE 4096
+#define NPAGES 64
+
+static char big[NPAGES * PAGE];
+
+static
+void
+touch(void)
+{
+    int i;
+
+    for (i = 0; i < NPAGES; i++) {
+        big[i * PAGE] = (char) i;
+    }
+}
+
+static
+void
+show(const char *what, const struct rusage *ru)
+{
+    printf("%s: utime %lu.%06lu stime %lu.%06lu\n", what,
+           (unsigned long) ru->ru_utime.tv_sec,
+           (unsigned long) ru->ru_utime.tv_usec,
+           (unsigned long) ru->ru_stime.tv_sec,
+           (unsigned long) ru->ru_stime.tv_usec);
+    printf("%s: rss %lukb maxrss %lukb, %lu minor and %lu major faults\n",
+           what, (unsigned long) ru->ru_rss, (unsigned long) ru->ru_maxrss,
+           (unsigned long) ru->ru_minflt, (unsigned long) ru->ru_majflt);
+    printf("%s: %lu TLB refills, %lu pages copied on write\n", what,
+           (unsigned long) ru->ru_tlbrefill,
+           (unsigned long) ru->ru_cowcopies);
+}
+
+int
+main()
+{
+    struct rusage before, after, child, children;
+    int status;
+    pid_t pid;
+
+    if (getrusage(RUSAGE_SELF, &before)) {
+        err(1, "getrusage");
+    }
+    touch();
+    if (getrusage(RUSAGE_SELF, &after)) {
+        err(1, "getrusage");
+    }
+    show("self", &after);
+    if (after.ru_minflt + after.ru_majflt <
+        before.ru_minflt + before.ru_majflt + NPAGES) {
+        errx(1, "touching %d pages took too few faults", NPAGES);
+    }
+    if (after.ru_maxrss < NPAGES * (PAGE / 1024)) {
+        errx(1, "maxrss too small");
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        /* every page is shared with the parent: writes copy them */
+        touch();
+        _exit(0);
+    }
+    if (wait4(pid, &status, 0, &child) != pid) {
+        err(1, "wait4");
+    }
+    show("child", &child);
+    if (child.ru_cowcopies < NPAGES) {
+        errx(1, "child copied too few pages on write");
+    }
+
+    if (getrusage(RUSAGE_CHILDREN, &children)) {
+        err(1, "getrusage children");
+    }
+    if (children.ru_cowcopies != child.ru_cowcopies) {
+        errx(1, "children totals do not match wait4");
+    }
+
+    if (getrusage(42, &children) == 0 || errno != EINVAL) {
+        errx(1, "getrusage with a bad who did not fail with EINVAL");
+    }
+
+    printf("testrusage: passed\n");
+    return 0;
+}